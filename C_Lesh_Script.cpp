@@ -6,41 +6,100 @@
 #include "C_Lesh_Script.h"
 
 Codeloader::cSimulator* simulator = NULL;
+Codeloader::cHot_Loader* hot_loader = NULL;
+Codeloader::cFrame_Pacer* pacer = NULL;
+Codeloader::cRecorder* recorder = NULL;
 
 bool Source_Process();
 bool Process_Keys();
+void Replay();
+void Render(Codeloader::cSoftware_IO& software, std::string prefix);
 
 // **************************************************************************
 // Program Entry Point
 // **************************************************************************
 
 int main(int argc, char** argv) {
-  if (argc == 2) {
+  if ((argc == 2) || (argc == 4)) {
     std::string program = argv[1];
+    std::string mode = (argc == 4) ? argv[2] : "";
+    std::string log = (argc == 4) ? argv[3] : "";
     try {
       Codeloader::cConfig config("Config");
       int memory_size = config.Get_Property("memory");
-      Codeloader::cMemory memory(memory_size);
+      Codeloader::cMemory memory(memory_size, config.Get_Property("heap"));
+      Codeloader::Register_Natives();
       Codeloader::cCompiler compiler(program, &memory);
       int width = config.Get_Property("width");
       int height = config.Get_Property("height");
-      Codeloader::cAllegro_IO allegro(program, width, height, 2, "Game");
       int prgm_start = config.Get_Property("program");
-      simulator = new Codeloader::cSimulator(&memory, &allegro, prgm_start);
-      allegro.Load_Resources("Resources");
-      allegro.Load_Button_Names("Button_Names");
-      allegro.Load_Button_Map("Buttons");
-      allegro.Process_Messages(Source_Process, Process_Keys);
+      if (mode == "replay") {
+        Codeloader::cHeadless_IO headless;
+        simulator = new Codeloader::cSimulator(&memory, &headless, prgm_start);
+        simulator->view_width = width;
+        simulator->view_height = height;
+        recorder = new Codeloader::cRecorder(log, Codeloader::eRECORD_REPLAY);
+        simulator->recorder = recorder;
+        Replay();
+      }
+      else if (mode == "render") {
+        Codeloader::cSoftware_IO software(width, height);
+        simulator = new Codeloader::cSimulator(&memory, &software, prgm_start);
+        simulator->view_width = width;
+        simulator->view_height = height;
+        Render(software, log);
+      }
+      else {
+        Codeloader::cAllegro_IO allegro(program, width, height, 2, "Game");
+        simulator = new Codeloader::cSimulator(&memory, &allegro, prgm_start);
+        simulator->view_width = width;
+        simulator->view_height = height;
+        simulator->metrics.file = program + ".prom";
+        simulator->metrics.period = config.Get_Property("metrics");
+        simulator->quota.instructions = config.Get_Property("quota_instructions");
+        simulator->quota.stack = config.Get_Property("quota_stack");
+        simulator->quota.string = config.Get_Property("quota_string");
+        simulator->quota.fields = config.Get_Property("quota_fields");
+        simulator->quota.read = config.Get_Property("quota_read");
+        simulator->quota.written = config.Get_Property("quota_written");
+        simulator->quota.memory = config.Get_Property("quota_memory");
+        simulator->quota.instances = config.Get_Property("quota_instances");
+        if (mode == "record") {
+          recorder = new Codeloader::cRecorder(log, Codeloader::eRECORD_WRITE);
+          simulator->recorder = recorder;
+        }
+        else if (mode != "") {
+          throw Codeloader::cError("Invalid mode " + mode + ".");
+        }
+        pacer = new Codeloader::cFrame_Pacer(config.Get_Property("fps"));
+        int watch = config.Get_Property("watch");
+        if (watch > 0) {
+          hot_loader = new Codeloader::cHot_Loader(&compiler, simulator, watch);
+        }
+        allegro.Load_Resources("Resources");
+        allegro.Load_Button_Names("Button_Names");
+        allegro.Load_Button_Map("Buttons");
+        allegro.Process_Messages(Source_Process, Process_Keys);
+      }
     }
     catch (Codeloader::cError error) {
       error.Print();
     }
+    if (hot_loader) {
+      delete hot_loader;
+    }
+    if (pacer) {
+      delete pacer;
+    }
+    if (recorder) {
+      delete recorder;
+    }
     if (simulator) {
       delete simulator;
     }
   }
   else {
-    std::cout << "Usage: " << argv[0] << " <program>" << std::endl;
+    std::cout << "Usage: " << argv[0] << " <program> [record|replay <log>|render <prefix>]" << std::endl;
   }
   std::cout << "Done." << std::endl;
   return 0;
@@ -55,10 +114,59 @@ int main(int argc, char** argv) {
  * @return True if the app needs to exit, false otherwise.
  */
 bool Source_Process() {
-  simulator->Run(20);
+  if (hot_loader && hot_loader->Check()) {
+    hot_loader->Reload();
+  }
+  pacer->Process(simulator);
   return false;
 }
 
+/**
+ * Replays a recorded session as fast as possible and reports the time.
+ */
+void Replay() {
+  auto start = std::chrono::steady_clock::now();
+  long long instructions = 0;
+  int slices = 0;
+  while (recorder->Has_Slice()) {
+    instructions += recorder->Get_Count();
+    slices++;
+    simulator->Run(0);
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+  std::cout << "Replayed " << slices << " slices, " << instructions << " instructions in " << diff.count() << " ms." << std::endl;
+}
+
+/**
+ * Runs the program on the software renderer as fast as possible. Every
+ * refreshed frame is written to a numbered bitmap and the repainted area
+ * is reported.
+ * @param software The software renderer.
+ * @param prefix The start of the frame file names.
+ */
+void Render(Codeloader::cSoftware_IO& software, std::string prefix) {
+  auto start = std::chrono::steady_clock::now();
+  int frames = 0;
+  int idle = 0;
+  while ((simulator->status != Codeloader::eSTATUS_DONE) && (frames < Codeloader::RENDER_FRAME_LIMIT) && (idle < Codeloader::RENDER_IDLE_LIMIT)) {
+    simulator->Run(1000);
+    if (simulator->frame_done) {
+      software.Dump_Frame(prefix + "_" + Codeloader::Number_To_Text(frames) + ".bmp");
+      frames++;
+      idle = 0;
+    }
+    else if (simulator->blocked) { // Waiting on input or I/O.
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      idle++;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+  long long area = (long long)software.width * software.height * std::max(1, frames);
+  std::cout << "Rendered " << frames << " frames in " << diff.count() << " ms, repainted " << (software.repainted * 100 / area) << "% of the pixels." << std::endl;
+}
+
 /**
  * Called when keys are processed.
  * @return True if the app needs to exit, false otherwise.
@@ -76,10 +184,16 @@ namespace Codeloader {
   /**
    * Creates a new memory module.
    * @param size The size of the memory.
+   * @param heap_size The number of blocks at the end of memory for the heap,
+   * or 0 for all memory above the program.
    */
-  cMemory::cMemory(int size) {
+  cMemory::cMemory(int size, int heap_size) {
     this->count = size;
+    this->heap_size = std::min(std::max(heap_size, 0), size);
     this->memory = new cBlock[size];
+    this->stamps = new unsigned long long[size];
+    this->links = new int[size];
+    this->classes = new int[size];
     this->Clear();
   }
 
@@ -88,6 +202,9 @@ namespace Codeloader {
    */
   cMemory::~cMemory() {
     delete[] this->memory;
+    delete[] this->stamps;
+    delete[] this->links;
+    delete[] this->classes;
   }
 
   /**
@@ -103,16 +220,191 @@ namespace Codeloader {
     return this->memory[address];
   }
 
+  /**
+   * Accesses an address of the memory for writing. The block is stamped
+   * so incremental saves can tell it changed.
+   * @param address The address to access.
+   * @return A reference to the block at the address.
+   * @throws An error if the address is invalid.
+   */
+  cBlock& cMemory::Write(int address) {
+    cBlock& block = (*this)[address];
+    this->stamps[address] = ++this->clock;
+    return block;
+  }
+
   /**
    * Clears out the memory.
    */
   void cMemory::Clear() {
+    this->clock = 0;
     for (int block_index = 0; block_index < this->count; block_index++) {
       cBlock& block = this->memory[block_index];
       block.Clear();
+      this->stamps[block_index] = 0;
+    }
+    this->Init_Heap(0);
+  }
+
+  /**
+   * Sets up the heap. With a heap size it covers the end of memory and
+   * memory below it is never touched by alloc or scratch, otherwise it
+   * takes everything above the program. Pools grow up from the start and
+   * the scratch arena grows down from the end of memory.
+   * @param program_end The address after the program.
+   * @throws An error if the program runs into a sized heap.
+   */
+  void cMemory::Init_Heap(int program_end) {
+    int start = (this->heap_size > 0) ? this->count - this->heap_size : program_end;
+    if (program_end > start) {
+      throw cError("Program runs into the heap at address " + Number_To_Text(start) + ".");
+    }
+    for (int class_index = 0; class_index < HEAP_CLASSES; class_index++) {
+      this->free_lists[class_index] = -1;
+    }
+    for (int block_index = 0; block_index < this->count; block_index++) {
+      this->classes[block_index] = -1;
+    }
+    this->heap_start = start;
+    this->heap_top = start;
+    this->arena_top = this->count;
+    this->heap = { 0, 0, 0, 0, 0, 0 };
+  }
+
+  /**
+   * Allocates blocks from the pool of the smallest size class that fits.
+   * Freed chunks are reused first, otherwise the heap is bumped. Blocks
+   * are cleared before they are handed out.
+   * @param size The number of blocks.
+   * @return The address of the first block or -1 if it does not fit.
+   */
+  int cMemory::Allocate(int size) {
+    int size_class = 0;
+    while ((size_class < HEAP_CLASSES) && ((1 << size_class) < size)) {
+      size_class++;
+    }
+    if ((size < 1) || (size_class == HEAP_CLASSES)) {
+      this->heap.failures++;
+      return -1;
+    }
+    int chunk = 1 << size_class;
+    int address = this->free_lists[size_class];
+    if (address >= 0) {
+      this->free_lists[size_class] = this->links[address];
+      this->heap.pooled -= chunk;
+#ifndef NDEBUG
+      if (!this->Is_Poisoned(address, chunk)) {
+        std::cout << "Heap: block " << address << " was written after it was freed." << std::endl;
+      }
+#endif
+    }
+    else {
+      if (this->heap_top + chunk > this->arena_top) {
+        this->heap.failures++;
+        return -1;
+      }
+      address = this->heap_top;
+      this->heap_top += chunk;
+    }
+    for (int block_index = 0; block_index < chunk; block_index++) {
+      this->Write(address + block_index).Clear();
+    }
+    this->classes[address] = size_class;
+    this->links[address] = size; // Requested size while allocated.
+    this->heap.used += chunk;
+    this->heap.requested += size;
+    this->heap.allocs++;
+    return address;
+  }
+
+  /**
+   * Returns blocks to the pool of their size class.
+   * @param address The address returned by the allocation.
+   * @return True if the blocks were freed, false if the address was not
+   * allocated.
+   */
+  bool cMemory::Free(int address) {
+    if ((address < this->heap_start) || (address >= this->heap_top) || (this->classes[address] < 0)) {
+      return false;
+    }
+    int size_class = this->classes[address];
+    int chunk = 1 << size_class;
+    this->heap.used -= chunk;
+    this->heap.requested -= this->links[address];
+    this->heap.pooled += chunk;
+    this->heap.frees++;
+    this->classes[address] = -1;
+    this->links[address] = this->free_lists[size_class];
+    this->free_lists[size_class] = address;
+#ifndef NDEBUG
+    this->Poison(address, chunk);
+#endif
+    return true;
+  }
+
+  /**
+   * Allocates blocks from the scratch arena.
+   * @param size The number of blocks.
+   * @return The address of the first block or -1 if it does not fit.
+   */
+  int cMemory::Allocate_Scratch(int size) {
+    if ((size < 1) || (this->arena_top - size < this->heap_top)) {
+      this->heap.failures++;
+      return -1;
+    }
+    this->arena_top -= size;
+    for (int block_index = 0; block_index < size; block_index++) {
+      this->Write(this->arena_top + block_index).Clear();
+    }
+    return this->arena_top;
+  }
+
+  /**
+   * Frees all scratch blocks allocated since a mark.
+   * @param mark The arena top when the mark was taken.
+   * @return True if the arena was released, false if the mark is invalid.
+   */
+  bool cMemory::Release(int mark) {
+    if ((mark < this->arena_top) || (mark > this->count)) {
+      return false;
+    }
+#ifndef NDEBUG
+    this->Poison(this->arena_top, mark - this->arena_top);
+#endif
+    this->arena_top = mark;
+    return true;
+  }
+
+  /**
+   * Fills freed blocks with a poison value so use after free can be seen.
+   * @param address The first block.
+   * @param size The number of blocks.
+   */
+  void cMemory::Poison(int address, int size) {
+    for (int block_index = 0; block_index < size; block_index++) {
+      cBlock& block = this->memory[address + block_index]; // Not stamped since saves need not see it.
+      block.Clear();
+      block.value.Set_Number(HEAP_POISON);
     }
   }
 
+  /**
+   * Determines if freed blocks still hold the poison. The free list link
+   * lives outside the blocks so the whole chunk is checked.
+   * @param address The first block.
+   * @param size The number of blocks.
+   * @return True if no block was written, false otherwise.
+   */
+  bool cMemory::Is_Poisoned(int address, int size) {
+    for (int block_index = 0; block_index < size; block_index++) {
+      cBlock& block = this->memory[address + block_index];
+      if ((block.code != eCMD_NONE) || (block.fields.Count() > 0) || block.dict || (block.value.number != HEAP_POISON)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   // **************************************************************************
   // Compiler Implementation
   // **************************************************************************
@@ -124,47 +416,378 @@ namespace Codeloader {
    */
   cCompiler::cCompiler(std::string source, cMemory* memory) {
     this->memory = memory;
+    this->Compile(source);
+  }
+
+  /**
+   * Creates a compiler for a relocatable unit and parses the tokens. The
+   * blocks are kept in the unit and labels are relative to its start.
+   * @param tokens The tokens of the unit.
+   * @throws An error if the tokens could not be parsed.
+   */
+  cCompiler::cCompiler(cArray<sCode_Token> tokens) {
+    this->memory = NULL;
     this->pointer = 0;
-    this->Parse_Tokens(source);
-    this->Preprocess();
+    this->tokens = tokens;
+    this->token_index = 0;
     this->Parse_Statements();
+  }
+
+  /**
+   * Compiles the source into memory. Modules that have not changed since
+   * the last compile are not read again. Modules are loaded and the
+   * code between imports is parsed into units on a thread pool, then the
+   * units are linked in import order. If a statement spans an import the
+   * source is compiled sequentially instead.
+   * @param source The source code name.
+   * @throws An error if the source could not be compiled.
+   */
+  void cCompiler::Compile(std::string source) {
+    this->source = source;
+    this->pointer = 0;
+    this->tokens = cArray<sCode_Token>();
+    this->token_index = 0;
+    this->symtab.Clear();
+    this->fixups = cArray<sFixup>();
+    this->symbols = cArray<sSymbol>();
+    this->labels = cArray<std::string>();
+    this->imported.Clear();
+    this->memory->Clear();
+    cThread_Pool& pool = cCompiler::Get_Pool();
+    this->Load_Modules(source, pool);
+    std::vector<cArray<sCode_Token>> segments;
+    this->Collect_Segments(source, segments);
+    this->imported.Clear();
+    std::vector<cCompiler*> units(segments.size(), NULL);
+    bool parsed = true;
+    try {
+      pool.For_Each(segments.size(), [&](int index) {
+        units[index] = new cCompiler(segments[index]);
+      });
+    }
+    catch (cError error) {
+      parsed = false;
+    }
+    if (parsed) {
+      this->Preprocess();
+      int unit_count = units.size();
+      for (int unit_index = 0; unit_index < unit_count; unit_index++) {
+        this->Link_Unit(*units[unit_index]);
+      }
+    }
+    else { // Sequential compile gives the same result or reports the error.
+      this->Parse_Tokens(source);
+      this->Preprocess();
+      this->Parse_Statements();
+    }
+    int unit_count = units.size();
+    for (int unit_index = 0; unit_index < unit_count; unit_index++) {
+      if (units[unit_index]) {
+        delete units[unit_index];
+      }
+    }
     this->Replace_Placeholders();
+    this->memory->Init_Heap(this->pointer);
+  }
+
+  /**
+   * Gets the thread pool shared by all compilers. It is started on first
+   * use and kept, so hot reloads and spawned instances reuse its threads.
+   * @return The thread pool.
+   */
+  cThread_Pool& cCompiler::Get_Pool() {
+    static cThread_Pool pool(std::thread::hardware_concurrency());
+    return pool;
+  }
+
+  /**
+   * Loads all modules reachable from the source. Each level of imports is
+   * read on the thread pool.
+   * @param source The name of the source code.
+   * @param pool The thread pool.
+   * @throws An error if a module could not be read.
+   */
+  void cCompiler::Load_Modules(std::string source, cThread_Pool& pool) {
+    std::vector<std::string> wave;
+    cHash<std::string, int> seen;
+    wave.push_back(source);
+    seen[source] = 1;
+    while (wave.size() > 0) {
+      int module_count = wave.size();
+      std::vector<sModule> loaded(module_count);
+      std::vector<int> current(module_count);
+      for (int module_index = 0; module_index < module_count; module_index++) {
+        current[module_index] = this->Is_Module_Current(wave[module_index]);
+      }
+      pool.For_Each(module_count, [&](int index) {
+        if (!current[index]) {
+          loaded[index] = this->Read_Module(wave[index]);
+        }
+      });
+      std::vector<std::string> next;
+      for (int module_index = 0; module_index < module_count; module_index++) {
+        if (!current[module_index]) {
+          this->modules[wave[module_index]] = loaded[module_index];
+        }
+        cArray<sCode_Token>& tokens = this->modules[wave[module_index]].tokens;
+        int tok_count = tokens.Count();
+        for (int tok_index = 0; tok_index < tok_count; tok_index++) {
+          if (tokens[tok_index].token == "import") {
+            std::string name = tokens[++tok_index].token;
+            if (!seen.Does_Key_Exist(name)) {
+              seen[name] = 1;
+              next.push_back(name);
+            }
+          }
+        }
+      }
+      wave = next;
+    }
+  }
+
+  /**
+   * Splits the loaded modules into segments at the imports, in the order
+   * the sequential compile would see the tokens.
+   * @param source The name of the source code.
+   * @param segments The list of segments to add to.
+   */
+  void cCompiler::Collect_Segments(std::string source, std::vector<cArray<sCode_Token>>& segments) {
+    if (this->imported.Does_Key_Exist(source)) {
+      return;
+    }
+    this->imported[source] = 1;
+    cArray<sCode_Token> tokens = this->modules[source].tokens;
+    segments.push_back(cArray<sCode_Token>());
+    int tok_count = tokens.Count();
+    for (int tok_index = 0; tok_index < tok_count; tok_index++) {
+      if (tokens[tok_index].token == "import") {
+        this->Collect_Segments(tokens[++tok_index].token, segments);
+        segments.push_back(cArray<sCode_Token>());
+      }
+      else {
+        segments.back().Add(tokens[tok_index]);
+      }
+    }
+  }
+
+  /**
+   * Links a relocatable unit at the current pointer.
+   * @param unit The parsed unit.
+   * @throws An error if the unit does not fit in memory.
+   */
+  void cCompiler::Link_Unit(cCompiler& unit) {
+    int base = this->pointer;
+    int symbol_count = unit.symbols.Count();
+    for (int symbol_index = 0; symbol_index < symbol_count; symbol_index++) {
+      sSymbol& symbol = unit.symbols[symbol_index];
+      this->Define_Symbol(symbol.name, symbol.relative ? base + symbol.value : symbol.value, symbol.relative);
+    }
+    int block_count = unit.blocks.size();
+    for (int block_index = 0; block_index < block_count; block_index++) {
+      this->Allocate_Block() = unit.blocks[block_index];
+    }
+    int fixup_count = unit.fixups.Count();
+    for (int fixup_index = 0; fixup_index < fixup_count; fixup_index++) {
+      sFixup fixup = unit.fixups[fixup_index];
+      fixup.address += base;
+      this->fixups.Add(fixup);
+    }
+  }
+
+  /**
+   * Allocates the next block of the program.
+   * @return The block.
+   * @throws An error if memory is full.
+   */
+  cBlock& cCompiler::Allocate_Block() {
+    this->pointer++;
+    if (this->memory) {
+      return (*this->memory)[this->pointer - 1];
+    }
+    this->blocks.push_back(cBlock());
+    return this->blocks.back();
+  }
+
+  /**
+   * Defines a symbol.
+   * @param name The name of the symbol with brackets.
+   * @param value The value of the symbol.
+   * @param relative True if the symbol is a label address, false otherwise.
+   */
+  void cCompiler::Define_Symbol(std::string name, int value, bool relative) {
+    sSymbol symbol;
+    symbol.name = name;
+    symbol.value = value;
+    symbol.relative = relative;
+    this->symbols.Add(symbol);
+    this->symtab[name] = value;
+    if (relative) {
+      this->labels.Add(name);
+    }
   }
 
   /**
-   * Parses tokens from a source file.
+   * Parses tokens from a source file. A module that was already imported
+   * is not processed again.
    * @param source The name of the source code.
    * @throws An error if something went wrong.
    */
   void cCompiler::Parse_Tokens(std::string source) {
-    cFile source_file(source + ".clsh");
+    if (this->imported.Does_Key_Exist(source)) {
+      return;
+    }
+    this->imported[source] = 1;
+    cArray<sCode_Token> tokens = this->Load_Module(source);
+    int tok_count = tokens.Count();
+    for (int tok_index = 0; tok_index < tok_count; tok_index++) {
+      if (tokens[tok_index].token == "import") { // Import marker is followed by the name.
+        this->Parse_Tokens(tokens[++tok_index].token);
+      }
+      else {
+        this->tokens.Add(tokens[tok_index]);
+      }
+    }
+  }
+
+  /**
+   * Loads the tokens of a single module. The file is only read again if
+   * it was modified since it was last loaded.
+   * @param source The name of the source code.
+   * @return The tokens of the module.
+   * @throws An error if the module could not be read.
+   */
+  cArray<sCode_Token> cCompiler::Load_Module(std::string source) {
+    if (!this->Is_Module_Current(source)) {
+      this->modules[source] = this->Read_Module(source);
+    }
+    return this->modules[source].tokens;
+  }
+
+  /**
+   * Reads a module from disk. Imports are kept as an import marker
+   * followed by the module name. The module is only tokenized if its
+   * content hash does not match the on-disk cache. Does not change the
+   * compiler so modules can be read in parallel.
+   * @param source The name of the source code.
+   * @return The module.
+   * @throws An error if the module could not be read.
+   */
+  sModule cCompiler::Read_Module(std::string source) {
+    std::string file_name = source + ".clsh";
+    std::error_code error;
+    sModule module;
+    module.name = source;
+    module.time = std::filesystem::last_write_time(file_name, error);
+    cFile source_file(file_name);
     source_file.Read();
     int line_count = source_file.Count();
+    unsigned long long hash = HASH_SEED;
     for (int line_index = 0; line_index < line_count; line_index++) {
-      std::string line = source_file[line_index];
-      if (line.find("import") != std::string::npos) { // Source import.
+      hash = Hash_Text(source_file[line_index] + "\n", hash);
+    }
+    if (!this->Read_Module_Cache(source, hash, module)) {
+      for (int line_index = 0; line_index < line_count; line_index++) {
+        std::string line = source_file[line_index];
         cArray<std::string> tokens = Parse_C_Lesh_Line(line);
-        if (tokens.Count() == 2) {
-          std::string name = tokens[1];
-          this->Parse_Tokens(name);
-        }
-        else {
-          throw cError("Invalid import statement.");
+        if (line.find("import") != std::string::npos) { // Source import.
+          if (tokens.Count() != 2) {
+            throw cError("Invalid import statement.");
+          }
+          tokens[0] = "import";
         }
-      }
-      else {
-        // Parse the tokens.
-        cArray<std::string> tokens = Parse_C_Lesh_Line(line);
         int tok_count = tokens.Count();
         for (int tok_index = 0; tok_index < tok_count; tok_index++) {
-          sToken token;
-          token.line_no = line_index;
-          token.source = source;
-          token.token = tokens[tok_index];
-          this->tokens.Add(token);
+          module.tokens.Add(Make_Token(tokens[tok_index], line_index, source));
+        }
+      }
+      this->Write_Module_Cache(source, hash, module);
+    }
+    return module;
+  }
+
+  /**
+   * Determines if a module is loaded and unchanged on disk.
+   * @param source The name of the source code.
+   * @return True if the loaded module is current, false otherwise.
+   */
+  bool cCompiler::Is_Module_Current(std::string source) {
+    bool current = false;
+    if (this->modules.Does_Key_Exist(source)) {
+      std::error_code error;
+      std::filesystem::file_time_type time = std::filesystem::last_write_time(source + ".clsh", error);
+      current = (!error && (time == this->modules[source].time));
+    }
+    return current;
+  }
+
+  std::mutex cache_lock; // Spawned instances compile on their own threads.
+
+  /**
+   * Reads the tokens of a module from its cache file.
+   * @param source The name of the source code.
+   * @param hash The content hash of the source code.
+   * @param module The module to read the tokens into.
+   * @return True if the cache matched the format version and the content
+   * hash, false otherwise.
+   */
+  bool cCompiler::Read_Module_Cache(std::string source, unsigned long long hash, sModule& module) {
+    std::lock_guard<std::mutex> guard(cache_lock);
+    std::ifstream file(source + ".clshc");
+    bool found = false;
+    std::string header;
+    if (file && std::getline(file, header) && (header == "clsh-cache " + std::to_string(CACHE_VERSION) + " " + std::to_string(hash))) {
+      cArray<sCode_Token> tokens;
+      std::string line;
+      found = true;
+      while (found && std::getline(file, line)) {
+        std::size_t space = line.find(' ');
+        if (space != std::string::npos) {
+          tokens.Add(Make_Token(line.substr(space + 1), std::atoi(line.substr(0, space).c_str()), source));
+        }
+        else { // Damaged cache.
+          found = false;
         }
       }
+      if (found) {
+        module.tokens = tokens;
+      }
+    }
+    return found;
+  }
+
+  /**
+   * Writes the tokens of a module to its cache file. A cache that cannot
+   * be written is skipped.
+   * @param source The name of the source code.
+   * @param hash The content hash of the source code.
+   * @param module The module with the tokens.
+   */
+  void cCompiler::Write_Module_Cache(std::string source, unsigned long long hash, sModule& module) {
+    std::lock_guard<std::mutex> guard(cache_lock);
+    std::ofstream file(source + ".clshc");
+    if (file) {
+      file << "clsh-cache " << CACHE_VERSION << " " << hash << "\n";
+      int tok_count = module.tokens.Count();
+      for (int tok_index = 0; tok_index < tok_count; tok_index++) {
+        file << module.tokens[tok_index].line_no << " " << module.tokens[tok_index].token << "\n";
+      }
+    }
+  }
+
+  /**
+   * Determines if any loaded module was modified on disk.
+   * @return True if a module changed, false otherwise.
+   */
+  bool cCompiler::Has_Changed() {
+    bool changed = false;
+    int module_count = this->modules.Count();
+    for (int module_index = 0; module_index < module_count; module_index++) {
+      if (!this->Is_Module_Current(this->modules.keys[module_index])) {
+        changed = true;
+        break;
+      }
     }
+    return changed;
   }
 
   /**
@@ -172,12 +795,12 @@ namespace Codeloader {
    * @return A token object.
    * @throws An error if there are no more tokens.
    */
-  sToken cCompiler::Parse_Token() {
-    sToken token = { "", 0, "" };
-    if (this->tokens.Count() == 0) {
+  sCode_Token cCompiler::Parse_Token() {
+    sCode_Token token = Make_Token("", 0, "");
+    if (this->token_index == this->tokens.Count()) {
       throw cError("No more tokens to parse!");
     }
-    token = this->tokens.Shift();
+    token = this->tokens[this->token_index++];
     return token;
   }
 
@@ -185,10 +808,10 @@ namespace Codeloader {
    * Returns a token from the stack but does not remove it.
    * @return The token.
    */
-  sToken cCompiler::Peek_Token() {
-    sToken token = { "", 0, "" };
-    if (this->tokens.Count() > 0) {
-      token = this->tokens.Peek_Front();
+  sCode_Token cCompiler::Peek_Token() {
+    sCode_Token token = Make_Token("", 0, "");
+    if (this->token_index < this->tokens.Count()) {
+      token = this->tokens[this->token_index];
     }
     return token;
   }
@@ -199,7 +822,7 @@ namespace Codeloader {
    * @throws An error if the keyword is missing.
    */
   void cCompiler::Parse_Keyword(std::string keyword) {
-    sToken token = this->Parse_Token();
+    sCode_Token token = this->Parse_Token();
     if (token.token != keyword) {
       this->Generate_Parse_Error("Missing keyword " + keyword + ".", token);
     }
@@ -211,12 +834,13 @@ namespace Codeloader {
    * @param token The associted token.
    * @throws An error.
    */
-  void cCompiler::Generate_Parse_Error(std::string message, sToken token) {
+  void cCompiler::Generate_Parse_Error(std::string message, sCode_Token token) {
     throw cError("Error: " + message + "\nLine No: " + Number_To_Text(token.line_no) + "\nSource: " + token.source + "\nToken: " + token.token);
   }
 
   /**
-   * Parses an expression.
+   * Parses an expression. Operands that name a symbol are recorded as
+   * fixups on the current block so they can be resolved after parsing.
    * @param command The command associated with the expression.
    * @return The index of the expression.
    * @throws An error if the expression is not valid.
@@ -232,7 +856,19 @@ namespace Codeloader {
       expression.push_back(operand);
     }
     command.expressions.Add(expression);
-    return (command.expressions.Count() - 1);
+    int exp_index = command.expressions.Count() - 1;
+    int operand_count = expression.size();
+    for (int operand_index = 0; operand_index < operand_count; operand_index += 2) { // Every other item is operand.
+      if (expression[operand_index].placeholder.length() > 0) {
+        sFixup fixup;
+        fixup.address = this->pointer - 1; // Commands parse into the last allocated block.
+        fixup.expression = exp_index;
+        fixup.operand = operand_index;
+        fixup.name = string_pool.Intern(expression[operand_index].placeholder);
+        this->fixups.Add(fixup);
+      }
+    }
+    return exp_index;
   }
 
   /**
@@ -241,7 +877,7 @@ namespace Codeloader {
    * @throws An error if the operand is invalid.
    */
   sOperand_Operator cCompiler::Parse_Operand() {
-    sToken token = Parse_Token();
+    sCode_Token token = Parse_Token();
     sOperand_Operator operand;
     if (token.token.length() > 1) {
       std::string address = token.token.substr(1);
@@ -253,9 +889,13 @@ namespace Codeloader {
         operand.addr_mode = eADDR_POINTER;
         this->Parse_Address(address, operand);
       }
+      else if (token.token[0] == '%') { // Frame slot addressing.
+        operand.addr_mode = eADDR_FRAME;
+        this->Parse_Address(address, operand);
+      }
       else if (token.token[0] == '$') { // String value.
         operand.addr_mode = eADDR_VAL_STRING;
-        operand.value.Set_String(address); // No placeholder.
+        operand.value.Set_Interned(address); // No placeholder.
       }
       else { // Numeric value.
         operand.addr_mode = eADDR_VAL_NUMBER;
@@ -275,7 +915,7 @@ namespace Codeloader {
    */
   sOperand_Operator cCompiler::Parse_Operator() {
     sOperand_Operator oper;
-    sToken token = this->Parse_Token();
+    sCode_Token token = this->Parse_Token();
     if (token.token == "+") {
       oper.oper_code = eOPER_ADD;
     }
@@ -314,7 +954,7 @@ namespace Codeloader {
    * @return True if the token is an operator, false otherwise.
    */
   bool cCompiler::Is_Operator() {
-    sToken token = this->Peek_Token();
+    sCode_Token token = this->Peek_Token();
     return ((token.token == "+") ||
             (token.token == "-") ||
             (token.token == "*") ||
@@ -344,15 +984,19 @@ namespace Codeloader {
       if (operand.addr_mode == eADDR_VAL_NUMBER) {
         throw cError("Cannot have object notation with numeric value.");
       }
+      if (operand.addr_mode == eADDR_FRAME) {
+        throw cError("Cannot have object notation with frame slot.");
+      }
     }
     else {
       throw cError("Invalid address " + address + ".");
     }
     // Check if address is a number.
-    try {
-      operand.value.Set_Number(Text_To_Number(addr));
+    int number = 0;
+    if (Parse_Number(addr, number)) {
+      operand.value.Set_Number(number);
     }
-    catch (cError error) {
+    else {
       operand.placeholder = addr;
     }
   }
@@ -382,7 +1026,7 @@ namespace Codeloader {
   sCondition_Logic cCompiler::Parse_Condition(cBlock& block) {
     sCondition_Logic condition;
     condition.left_exp = this->Parse_Expression(block);
-    sToken test = this->Parse_Token();
+    sCode_Token test = this->Parse_Token();
     if (test.token == "eq") {
       condition.test = eTEST_EQUALS;
     }
@@ -415,7 +1059,7 @@ namespace Codeloader {
    */
   sCondition_Logic cCompiler::Parse_Logic() {
     sCondition_Logic logic = { 0, 0, 0, 0 };
-    sToken token = this->Parse_Token();
+    sCode_Token token = this->Parse_Token();
     if (token.token == "and") {
       logic.logic_code = eLOGIC_AND;
     }
@@ -433,7 +1077,7 @@ namespace Codeloader {
    * @return True if the next token is logic, false otherwise.
    */
   bool cCompiler::Is_Logic() {
-    sToken token = this->Peek_Token();
+    sCode_Token token = this->Peek_Token();
     return ((token.token == "and") || (token.token == "or"));
   }
 
@@ -442,55 +1086,57 @@ namespace Codeloader {
    * @throws An error if the statement is invalid.
    */
   void cCompiler::Parse_Statements() {
-    while (this->tokens.Count() > 0) {
-      sToken token = this->Parse_Token();
+    while (this->token_index < this->tokens.Count()) {
+      sCode_Token token = this->Parse_Token();
       if (token.token == "define") {
-        sToken name = this->Parse_Token();
+        sCode_Token name = this->Parse_Token();
         this->Parse_Keyword("as");
-        sToken value = this->Parse_Token();
-        this->symtab["[" + name.token + "]"] = Text_To_Number(value.token);
+        sCode_Token value = this->Parse_Token();
+        if (value.type != eTOKEN_NUMBER) {
+          this->Generate_Parse_Error("Invalid definition value.", value);
+        }
+        this->Define_Symbol("[" + name.token + "]", value.number, false);
       }
       else if (token.token == "map") {
-        sToken item = this->Parse_Token();
+        sCode_Token item = this->Parse_Token();
         int index = 0;
         while (item.token != "end") {
-          this->symtab["[" + item.token + "]"] = index++;
+          this->Define_Symbol("[" + item.token + "]", index++, false);
           item = this->Parse_Token();
         }
       }
       else if (token.token == "label") {
-        sToken name = this->Parse_Token();
-        this->symtab["[" + name.token + "]"] = this->pointer;
+        sCode_Token name = this->Parse_Token();
+        this->Define_Symbol("[" + name.token + "]", this->pointer, true);
       }
       else if (token.token == "number") {
-        sToken number = this->Parse_Token();
-        cBlock& block = (*this->memory)[this->pointer++];
-        block.value.Set_Number(Text_To_Number(number.token));
+        sCode_Token number = this->Parse_Token();
+        if (number.type != eTOKEN_NUMBER) {
+          this->Generate_Parse_Error("Invalid number.", number);
+        }
+        cBlock& block = this->Allocate_Block();
+        block.value.Set_Number(number.number);
       }
       else if (token.token == "list") {
-        sToken count = this->Parse_Token();
-        int item_count = Text_To_Number(count.token);
+        sCode_Token count = this->Parse_Token();
+        if (count.type != eTOKEN_NUMBER) {
+          this->Generate_Parse_Error("Invalid list count.", count);
+        }
+        int item_count = count.number;
         for (int item_index = 0; item_index < item_count; item_index++) {
-          cBlock& block = (*this->memory)[this->pointer++];
+          cBlock& block = this->Allocate_Block();
           block.value.Set_Number(0);
         }
       }
       else if (token.token == "object") {
-        sToken property = this->Parse_Token();
-        cBlock& block = (*this->memory)[this->pointer++];
+        sCode_Token property = this->Parse_Token();
+        cBlock& block = this->Allocate_Block();
         while (property.token != "end") {
           cArray<std::string> pair = Parse_Sausage_Text(property.token, "=");
           if (pair.Count() == 2) {
             std::string name = pair[0];
             std::string value = pair[1];
-            block.fields[name] = cValue();
-            try {
-              int number = Text_To_Number(value);
-              block.fields[name].Set_Number(number);
-            }
-            catch (cError error) { // A string.
-              block.fields[name].Set_String(value);
-            }
+            Parse_Value(value, block.fields[name], true);
           }
           else {
             this->Generate_Parse_Error("Invalid property format.", property);
@@ -499,20 +1145,20 @@ namespace Codeloader {
         }
       }
       else if (token.token == "{remark}") {
-        sToken token = this->Parse_Token();
+        sCode_Token token = this->Parse_Token();
         while (token.token != "{end}") {
           // Do nothing.
         }
       }
       else if (token.token == "store") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_STORE;
         this->Parse_Expression(command);
         this->Parse_Keyword("at");
         this->Parse_Expression(command); // Pointer
       }
       else if (token.token == "set") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_SET;
         this->Parse_Expression(command); // Pointer
         this->Parse_Expression(command); // Field
@@ -520,7 +1166,7 @@ namespace Codeloader {
         this->Parse_Expression(command);
       }
       else if (token.token == "test") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_TEST;
         this->Parse_Conditional(command);
         this->Parse_Keyword("then");
@@ -529,20 +1175,20 @@ namespace Codeloader {
         this->Parse_Expression(command);
       }
       else if (token.token == "call") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_CALL;
         this->Parse_Expression(command);
       }
       else if (token.token == "return") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_RETURN;
       }
       else if (token.token == "stop") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_STOP;
       }
       else if (token.token == "output") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_OUTPUT;
         this->Parse_Expression(command); // Contains the string.
         this->Parse_Keyword("at");
@@ -554,7 +1200,7 @@ namespace Codeloader {
         this->Parse_Expression(command); // Blue
       }
       else if (token.token == "draw") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_DRAW;
         this->Parse_Expression(command); // Picture name.
         this->Parse_Keyword("at");
@@ -568,43 +1214,357 @@ namespace Codeloader {
         this->Parse_Expression(command);
         this->Parse_Expression(command);
       }
-      else if (token.token == "refresh") {
-        cBlock& command = (*this->memory)[this->pointer++];
-        command.code = eCMD_REFRESH;
+      else if (token.token == "draw-map") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_DRAW_MAP;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("size");
+        this->Parse_Expression(command); // Columns
+        this->Parse_Expression(command); // Rows
+        this->Parse_Keyword("tile");
+        this->Parse_Expression(command); // Tile size.
+        this->Parse_Keyword("image");
+        this->Parse_Expression(command); // Tileset name.
+        this->Parse_Keyword("camera");
+        this->Parse_Expression(command); // Coordinates
+        this->Parse_Expression(command);
       }
-      else if (token.token == "sound") {
-        cBlock& command = (*this->memory)[this->pointer++];
-        command.code = eCMD_SOUND;
-        this->Parse_Expression(command); // The name of the sound.
+      else if (token.token == "spatial-build") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SPATIAL_BUILD;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("count");
+        this->Parse_Expression(command);
+        this->Parse_Keyword("cell");
+        this->Parse_Expression(command); // Cell size.
       }
-      else if (token.token == "music") {
-        cBlock& command = (*this->memory)[this->pointer++];
-        command.code = eCMD_MUSIC;
-        this->Parse_Expression(command); // The name of the track.
+      else if (token.token == "spatial-update") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SPATIAL_UPDATE;
       }
-      else if (token.token == "silence") {
-        cBlock& command = (*this->memory)[this->pointer++];
-        command.code = eCMD_SILENCE;
+      else if (token.token == "spatial-overlaps") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SPATIAL_OVERLAPS;
+        this->Parse_Expression(command); // Object pointer.
+        this->Parse_Keyword("into");
+        this->Parse_Expression(command); // List pointer.
+        this->Parse_Keyword("max");
+        this->Parse_Expression(command);
       }
-      else if (token.token == "input") {
-        cBlock& command = (*this->memory)[this->pointer++];
-        command.code = eCMD_INPUT;
-        this->Parse_Expression(command); // Pointer
+      else if (token.token == "spatial-point") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SPATIAL_POINT;
+        this->Parse_Expression(command); // Coordinates
+        this->Parse_Expression(command);
+        this->Parse_Keyword("into");
+        this->Parse_Expression(command); // List pointer.
+        this->Parse_Keyword("max");
+        this->Parse_Expression(command);
       }
-      else if (token.token == "timeout") {
-        cBlock& command = (*this->memory)[this->pointer++];
-        command.code = eCMD_TIMEOUT;
+      else if (token.token == "spatial-rect") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SPATIAL_RECT;
+        this->Parse_Expression(command); // Coordinates
+        this->Parse_Expression(command);
+        this->Parse_Expression(command); // Dimensions
+        this->Parse_Expression(command);
+        this->Parse_Keyword("into");
+        this->Parse_Expression(command); // List pointer.
+        this->Parse_Keyword("max");
         this->Parse_Expression(command);
       }
-      else if (token.token == "color") {
-        cBlock& command = (*this->memory)[this->pointer++];
+      else if (token.token == "find-path") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_FIND_PATH;
+        this->Parse_Expression(command); // Grid pointer.
+        this->Parse_Keyword("size");
+        this->Parse_Expression(command); // Columns
+        this->Parse_Expression(command); // Rows
+        this->Parse_Keyword("from");
+        this->Parse_Expression(command); // Start coordinates.
+        this->Parse_Expression(command);
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Goal coordinates.
+        this->Parse_Expression(command);
+        this->Parse_Keyword("into");
+        this->Parse_Expression(command); // List pointer.
+        this->Parse_Keyword("max");
+        this->Parse_Expression(command);
+        this->Parse_Keyword("budget");
+        this->Parse_Expression(command); // Node budget.
+      }
+      else if (token.token == "flow-field") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_FLOW_FIELD;
+        this->Parse_Expression(command); // Grid pointer.
+        this->Parse_Keyword("size");
+        this->Parse_Expression(command); // Columns
+        this->Parse_Expression(command); // Rows
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Goal coordinates.
+        this->Parse_Expression(command);
+        this->Parse_Keyword("into");
+        this->Parse_Expression(command); // List pointer.
+      }
+      else if (token.token == "parallel-each") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_PARALLEL_EACH;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("count");
+        this->Parse_Expression(command);
+        this->Parse_Keyword("call");
+        this->Parse_Expression(command); // Subroutine address.
+        this->Parse_Keyword("scratch");
+        this->Parse_Expression(command); // Scratch pointer.
+        this->Parse_Keyword("size");
+        this->Parse_Expression(command);
+      }
+      else if (token.token == "channel") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_CHANNEL;
+        this->Parse_Expression(command); // Name
+        this->Parse_Keyword("size");
+        this->Parse_Expression(command);
+        this->Parse_Keyword("producers");
+        this->Parse_Expression(command);
+        if (this->Peek_Token().token == "of") {
+          this->Parse_Keyword("of");
+          sCode_Token element = this->Parse_Token();
+          if (element.token == "numbers") {
+            command.value.Set_Number(eELEMENT_NUMBER);
+          }
+          else if (element.token == "strings") {
+            command.value.Set_Number(eELEMENT_STRING);
+          }
+          else {
+            this->Generate_Parse_Error("Channel must be of numbers or strings.", element);
+          }
+        }
+      }
+      else if (token.token == "send") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SEND;
+        this->Parse_Expression(command); // Value
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Name
+      }
+      else if (token.token == "try-send") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_TRY_SEND;
+        this->Parse_Expression(command); // Value
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Name
+        this->Parse_Keyword("status");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "receive") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_RECEIVE;
+        this->Parse_Expression(command); // Name
+        this->Parse_Keyword("at");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "try-receive") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_TRY_RECEIVE;
+        this->Parse_Expression(command); // Name
+        this->Parse_Keyword("at");
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("status");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "spawn") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SPAWN;
+        this->Parse_Expression(command); // Program name.
+        this->Parse_Keyword("memory");
+        this->Parse_Expression(command);
+        this->Parse_Keyword("start");
+        this->Parse_Expression(command); // Start address.
+        if (this->Peek_Token().token == "heap") {
+          this->Parse_Keyword("heap");
+          this->Parse_Expression(command); // Heap size.
+          command.value.Set_Number(1); // Marks the heap expression.
+        }
+        if (this->Peek_Token().token == "quota") {
+          this->Parse_Keyword("quota");
+          this->Parse_Expression(command); // Quota object pointer.
+        }
+      }
+      else if (token.token == "quota-usage") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_QUOTA_USAGE;
+        this->Parse_Expression(command); // Pointer
+      }
+      else if ((token.token == "schedule") || (token.token == "schedule-frames")) {
+        cBlock& command = this->Allocate_Block();
+        command.code = (token.token == "schedule") ? eCMD_SCHEDULE : eCMD_SCHEDULE_FRAMES;
+        this->Parse_Expression(command); // Label address.
+        this->Parse_Keyword("after");
+        this->Parse_Expression(command); // Delay
+        this->Parse_Keyword("handle");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "cancel") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_CANCEL;
+        this->Parse_Expression(command); // Handle
+      }
+      else if ((token.token == "invoke") || (token.token == "tail-invoke")) {
+        cBlock& command = this->Allocate_Block();
+        command.code = (token.token == "invoke") ? eCMD_INVOKE : eCMD_TAIL_INVOKE;
+        this->Parse_Expression(command); // Label address.
+        int arg_count = 0;
+        if (this->Peek_Token().token == "with") {
+          this->Parse_Keyword("with");
+          while (this->Peek_Token().token != "end") {
+            this->Parse_Expression(command); // Argument
+            arg_count++;
+          }
+          this->Parse_Keyword("end");
+        }
+        command.value.Set_Number(arg_count);
+        if ((command.code == eCMD_INVOKE) && (this->Peek_Token().token == "into")) {
+          this->Parse_Keyword("into");
+          this->Parse_Expression(command); // Result slot.
+        }
+      }
+      else if (token.token == "enter") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_ENTER;
+        this->Parse_Expression(command); // Slot count.
+      }
+      else if (token.token == "leave") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_LEAVE;
+        if (this->Peek_Token().token == "with") {
+          this->Parse_Keyword("with");
+          this->Parse_Expression(command); // Result
+        }
+      }
+      else if (token.token == "store-local") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_STORE_LOCAL;
+        this->Parse_Expression(command);
+        this->Parse_Keyword("at");
+        this->Parse_Expression(command); // Slot
+      }
+      else if ((token.token == "alloc") || (token.token == "scratch")) {
+        cBlock& command = this->Allocate_Block();
+        command.code = (token.token == "alloc") ? eCMD_ALLOC : eCMD_SCRATCH;
+        this->Parse_Expression(command); // Block count.
+        this->Parse_Keyword("at");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "free") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_FREE;
+        this->Parse_Expression(command); // Address
+      }
+      else if (token.token == "mark") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_MARK;
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "release") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_RELEASE;
+        this->Parse_Expression(command); // Mark
+      }
+      else if (token.token == "heap-stats") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_HEAP_STATS;
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "dict-set") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_DICT_SET;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("key");
+        this->Parse_Expression(command); // Key
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Value
+      }
+      else if ((token.token == "dict-get") || (token.token == "dict-has")) {
+        cBlock& command = this->Allocate_Block();
+        command.code = (token.token == "dict-get") ? eCMD_DICT_GET : eCMD_DICT_HAS;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("key");
+        this->Parse_Expression(command); // Key
+        this->Parse_Keyword("at");
+        this->Parse_Expression(command); // Result pointer.
+        if ((command.code == eCMD_DICT_GET) && (this->Peek_Token().token == "or")) {
+          this->Parse_Keyword("or");
+          this->Parse_Expression(command); // Default
+        }
+      }
+      else if (token.token == "dict-remove") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_DICT_REMOVE;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("key");
+        this->Parse_Expression(command); // Key
+      }
+      else if (token.token == "dict-count") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_DICT_COUNT;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("at");
+        this->Parse_Expression(command); // Result pointer.
+      }
+      else if (token.token == "dict-entry") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_DICT_ENTRY;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("index");
+        this->Parse_Expression(command); // Index
+        this->Parse_Keyword("key");
+        this->Parse_Expression(command); // Key pointer.
+        this->Parse_Keyword("value");
+        this->Parse_Expression(command); // Value pointer.
+      }
+      else if (token.token == "dict-clear") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_DICT_CLEAR;
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "refresh") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_REFRESH;
+      }
+      else if (token.token == "sound") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SOUND;
+        this->Parse_Expression(command); // The name of the sound.
+      }
+      else if (token.token == "music") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_MUSIC;
+        this->Parse_Expression(command); // The name of the track.
+      }
+      else if (token.token == "silence") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SILENCE;
+      }
+      else if (token.token == "input") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_INPUT;
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "timeout") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_TIMEOUT;
+        this->Parse_Expression(command);
+      }
+      else if (token.token == "color") {
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_COLOR;
         this->Parse_Expression(command); // Red
         this->Parse_Expression(command); // Green
         this->Parse_Expression(command); // Blue
       }
       else if (token.token == "load") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_LOAD;
         this->Parse_Expression(command); // Name
         this->Parse_Keyword("at");
@@ -613,7 +1573,7 @@ namespace Codeloader {
         this->Parse_Expression(command); // Pointer
       }
       else if (token.token == "save") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_SAVE;
         this->Parse_Expression(command); // Pointer
         this->Parse_Keyword("to");
@@ -622,17 +1582,17 @@ namespace Codeloader {
         this->Parse_Expression(command);
       }
       else if (token.token == "push") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_PUSH;
         this->Parse_Expression(command);
       }
       else if (token.token == "pop") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_POP;
         this->Parse_Expression(command); // Pointer
       }
       else if (token.token == "repeat") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_REPEAT;
         this->Parse_Expression(command);
         this->Parse_Keyword("to");
@@ -643,7 +1603,7 @@ namespace Codeloader {
         this->Parse_Expression(command);
       }
       else if (token.token == "get-object") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_GET_OBJECT;
         this->Parse_Expression(command); // Pointer
         this->Parse_Keyword("from");
@@ -651,13 +1611,86 @@ namespace Codeloader {
         this->Parse_Expression(command); // Field
       }
       else if (token.token == "get-list") {
-        cBlock& command = (*this->memory)[this->pointer++];
+        cBlock& command = this->Allocate_Block();
         command.code = eCMD_GET_LIST;
         this->Parse_Expression(command); // Pointer
         this->Parse_Keyword("from");
         this->Parse_Expression(command); // Pointer
         this->Parse_Expression(command); // Field
       }
+      else if (token.token == "input-events") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_INPUT_EVENTS;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("count");
+        this->Parse_Expression(command);
+      }
+      else if (token.token == "input-wait") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_INPUT_WAIT;
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("timeout");
+        this->Parse_Expression(command);
+      }
+      else if (token.token == "load-async") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_LOAD_ASYNC;
+        this->Parse_Expression(command); // Name
+        this->Parse_Keyword("at");
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("count");
+        this->Parse_Expression(command);
+        this->Parse_Keyword("status");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "save-changes") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SAVE_CHANGES;
+        this->Parse_Expression(command); // Name
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("count");
+        this->Parse_Expression(command);
+      }
+      else if (token.token == "call-native") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_CALL_NATIVE;
+        sCode_Token name = this->Parse_Token();
+        int function = native_registry.Find(name.token);
+        if (function < 0) {
+          this->Generate_Parse_Error("Unknown native function.", name);
+        }
+        command.value.Set_Number(function); // Resolved once here.
+        while (this->Peek_Token().token != "to") {
+          if (command.expressions.Count() == NATIVE_ARG_LIMIT) {
+            this->Generate_Parse_Error("Too many native arguments.", name);
+          }
+          this->Parse_Expression(command); // Argument
+        }
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "save-async") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_SAVE_ASYNC;
+        this->Parse_Expression(command); // Name
+        this->Parse_Keyword("to");
+        this->Parse_Expression(command); // Pointer
+        this->Parse_Keyword("count");
+        this->Parse_Expression(command);
+        this->Parse_Keyword("status");
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "io-wait") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_IO_WAIT;
+        this->Parse_Expression(command); // Pointer
+      }
+      else if (token.token == "frame-stats") {
+        cBlock& command = this->Allocate_Block();
+        command.code = eCMD_FRAME_STATS;
+        this->Parse_Expression(command); // Pointer
+      }
       else {
         this->Generate_Parse_Error("Invalid statement " + token.token + ".", token);
       }
@@ -665,29 +1698,19 @@ namespace Codeloader {
   }
 
   /**
-   * Replaces all placeholders.
+   * Replaces all placeholders from the fixups recorded during parsing.
    * @throws An error if a placeholder is not found.
    */
   void cCompiler::Replace_Placeholders() {
-    for (int block_index = 0; block_index < this->memory->count; block_index++) {
-      cBlock& block = (*this->memory)[block_index];
-      int exp_count = block.expressions.Count();
-      for (int exp_index = 0; exp_index < exp_count; exp_index++) {
-        tExpression& expression = block.expressions[exp_index];
-        int operand_count = expression.size();
-        for (int operand_index = 0; operand_index < operand_count; operand_index += 2) { // Every other item is operand.
-          sOperand_Operator& operand = expression[operand_index];
-          if (operand.placeholder.length() > 0) {
-            if (this->symtab.Does_Key_Exist(operand.placeholder)) { // Found it!
-              int value = this->symtab[operand.placeholder];
-              operand.value.Set_Number(value);
-            }
-            else {
-              throw cError("Could not find placeholder " + operand.placeholder + ".");
-            }
-          }
-        }
+    int fixup_count = this->fixups.Count();
+    for (int fixup_index = 0; fixup_index < fixup_count; fixup_index++) {
+      sFixup& fixup = this->fixups[fixup_index];
+      int* value = this->symtab.Find(fixup.name);
+      if (!value) {
+        throw cError("Could not find placeholder " + *fixup.name + ".");
       }
+      cBlock& block = (*this->memory)[fixup.address];
+      block.expressions[fixup.expression][fixup.operand].value.Set_Number(*value);
     }
   }
 
@@ -702,87 +1725,815 @@ namespace Codeloader {
   }
 
   // **************************************************************************
-  // Block Implementation
+  // Symbol Table Implementation
   // **************************************************************************
 
   /**
-   * Creates a new block.
+   * Creates an empty symbol table. Names are interned so a slot matches
+   * by pointer and the hash is taken from the pointer.
    */
-  cBlock::cBlock() {
+  cSymbol_Table::cSymbol_Table() {
     this->Clear();
   }
 
-  void cBlock::Clear() {
-    this->value.Set_Number(0);
-    this->code = eCMD_NONE;
-    this->fields.Clear();
+  /**
+   * Gets the value of a symbol and adds the symbol if it is new.
+   * @param name The name of the symbol.
+   * @return The value of the symbol.
+   */
+  int& cSymbol_Table::operator[] (std::string name) {
+    tString key = string_pool.Intern(name);
+    int slot = this->Probe(key.get());
+    if (!this->slots[slot].name) {
+      if (2 * (this->count + 1) > (int)this->slots.size()) { // Keep the table at most half full.
+        this->Grow();
+        slot = this->Probe(key.get());
+      }
+      this->slots[slot].name = key;
+      this->slots[slot].value = 0;
+      this->count++;
+    }
+    return this->slots[slot].value;
+  }
+
+  /**
+   * Finds a symbol by its interned name.
+   * @param name The interned name.
+   * @return The value of the symbol or NULL if it is not defined.
+   */
+  int* cSymbol_Table::Find(tString name) {
+    int slot = this->Probe(name.get());
+    return this->slots[slot].name ? &this->slots[slot].value : NULL;
+  }
+
+  /**
+   * Determines if a symbol is defined.
+   * @param name The name of the symbol.
+   * @return True if the symbol is defined, false otherwise.
+   */
+  bool cSymbol_Table::Does_Key_Exist(std::string name) {
+    return (this->Find(string_pool.Intern(name)) != NULL);
+  }
+
+  /**
+   * Gets the number of symbols.
+   * @return The number of symbols.
+   */
+  int cSymbol_Table::Count() {
+    return this->count;
+  }
+
+  /**
+   * Removes all symbols.
+   */
+  void cSymbol_Table::Clear() {
+    this->slots = std::vector<sSymbol_Slot>(SYMBOL_TABLE_MINIMUM);
+    this->count = 0;
+  }
+
+  /**
+   * Finds the slot of a name with linear probing.
+   * @param name The interned name.
+   * @return The slot holding the name or the empty slot where it belongs.
+   */
+  int cSymbol_Table::Probe(const std::string* name) {
+    int mask = this->slots.size() - 1;
+    unsigned long long hash = (unsigned long long)name * 0x9E3779B97F4A7C15ULL;
+    int slot = (int)(hash >> 32) & mask;
+    while (this->slots[slot].name && (this->slots[slot].name.get() != name)) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  /**
+   * Doubles the number of slots and puts the symbols back.
+   */
+  void cSymbol_Table::Grow() {
+    std::vector<sSymbol_Slot> old_slots(this->slots.size() * 2);
+    old_slots.swap(this->slots);
+    int slot_count = old_slots.size();
+    for (int slot_index = 0; slot_index < slot_count; slot_index++) {
+      if (old_slots[slot_index].name) {
+        int slot = this->Probe(old_slots[slot_index].name.get());
+        this->slots[slot] = old_slots[slot_index];
+      }
+    }
   }
 
   // **************************************************************************
-  // Simulator Implementation
+  // String Pool Implementation
   // **************************************************************************
 
+  cString_Pool string_pool;
+
   /**
-   * Creates a new simulator.
-   * @param memory The memory module reference.
-   * @param io The I/O control module reference.
-   * @param program The start address if the program.
+   * Interns a string. Equal strings share one immutable copy which is
+   * kept for the life of the program. Safe to call from any thread.
+   * @param text The text to intern.
+   * @return The shared copy of the text.
    */
-  cSimulator::cSimulator(cMemory* memory, cIO_Control* io, int program) {
-    this->memory = memory;
-    this->io = io;
-    this->pointer = program;
-    this->status = eSTATUS_IDLE;
+  tString cString_Pool::Intern(std::string text) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    tString& entry = this->strings[text];
+    if (!entry) {
+      entry = std::make_shared<const std::string>(text);
+    }
+    return entry;
   }
 
+  // **************************************************************************
+  // Script Value Implementation
+  // **************************************************************************
+
   /**
-   * Runs the simulator.
-   * @param timeout The amount of milliseconds run the program for.
+   * Creates a new value set to the number zero.
    */
-  void cSimulator::Run(int timeout) {
-    auto start = std::chrono::system_clock::now();
-    while (this->status == eSTATUS_RUNNING) {
-      auto end = std::chrono::system_clock::now();
-      auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      if (diff.count() < timeout) {
-        cBlock& command = (*this->memory)[this->pointer++];
-        this->Command_Processor(command);
-      }
-      else {
-        break;
-      }
+  cScript_Value::cScript_Value() {
+    this->type = eVALUE_NUMBER;
+    this->number = 0;
+    this->interned = false;
+  }
+
+  /**
+   * Sets the value to a number.
+   * @param number The number.
+   */
+  void cScript_Value::Set_Number(int number) {
+    this->type = eVALUE_NUMBER;
+    this->number = number;
+    this->interned = false;
+    this->text.reset();
+  }
+
+  /**
+   * Sets the value to a string made at runtime. The string is shared by
+   * reference count between the copies of the value.
+   * @param text The string.
+   */
+  void cScript_Value::Set_String(std::string text) {
+    this->type = eVALUE_STRING;
+    this->number = 0;
+    this->interned = false;
+    this->text = std::make_shared<const std::string>(text);
+  }
+
+  /**
+   * Sets the value to an interned string. Used for program literals so
+   * equal strings can be compared by pointer.
+   * @param text The string.
+   */
+  void cScript_Value::Set_Interned(std::string text) {
+    this->type = eVALUE_STRING;
+    this->number = 0;
+    this->interned = true;
+    this->text = string_pool.Intern(text);
+  }
+
+  /**
+   * Converts a number value into its string form.
+   */
+  void cScript_Value::Convert_To_String() {
+    this->Set_String(Number_To_Text(this->number));
+  }
+
+  /**
+   * Gets the string of the value.
+   * @return The string, or an empty string for numbers.
+   */
+  const std::string& cScript_Value::Get_String() const {
+    static const std::string empty;
+    return this->text ? *this->text : empty;
+  }
+
+  /**
+   * Tests if two string values are equal. Interned strings are equal only
+   * if they are the same copy.
+   * @param other The value to compare with.
+   * @return True if the strings are equal, false otherwise.
+   */
+  bool cScript_Value::Equals(const cScript_Value& other) const {
+    bool result = false;
+    if (this->text == other.text) {
+      result = true;
     }
+    else if (!(this->interned && other.interned)) {
+      result = (this->Get_String() == other.Get_String());
+    }
+    return result;
   }
 
+  // **************************************************************************
+  // Native Registry Implementation
+  // **************************************************************************
+
+  cNative_Registry native_registry;
+
   /**
-   * Runs the command processor.
-   * @param command The command to process.
-   * @throws An error if the command is invalid.
+   * Binds a native function to a name. Natives must be registered before
+   * the program is compiled since calls are resolved by the compiler.
+   * @param name The name scripts call the function by.
+   * @param function The function.
+   * @return The index of the function.
+   * @throws An error if the name is already taken.
    */
-  void cSimulator::Command_Processor(cBlock& command) {
+  int cNative_Registry::Register(std::string name, tNative_Function function) {
+    if (this->index.count(name) > 0) {
+      throw cError("Native function " + name + " is already registered.");
+    }
+    int function_index = this->functions.size();
+    this->functions.push_back(function);
+    this->names.push_back(name);
+    this->index[name] = function_index;
+    return function_index;
+  }
+
+  /**
+   * Finds a native function by name.
+   * @param name The name of the function.
+   * @return The index of the function or -1 if it was not found.
+   */
+  int cNative_Registry::Find(std::string name) {
+    std::unordered_map<std::string, int>::iterator entry = this->index.find(name);
+    return (entry != this->index.end()) ? entry->second : -1;
+  }
+
+  // **************************************************************************
+  // Block Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a new block.
+   */
+  cBlock::cBlock() {
+    this->Clear();
+  }
+
+  void cBlock::Clear() {
+    this->value.Set_Number(0);
+    this->code = eCMD_NONE;
+    this->fields.Clear();
+    this->dict.reset();
+  }
+
+  /**
+   * Gets the fields to save. Dictionary entries are stored inline as
+   * fields named with a marker, "#" and the number or "$" and the escaped
+   * string. String values of entries are escaped behind a "$" so they do
+   * not load back as numbers.
+   * @return The fields with the dictionary entries.
+   */
+  tObject cBlock::Pack_Fields() {
+    if (!this->dict) {
+      return this->fields;
+    }
+    tObject object = this->fields;
+    int entry_count = this->dict->Count();
+    for (int entry_index = 0; entry_index < entry_count; entry_index++) {
+      sDictionary_Entry& entry = this->dict->entries[entry_index];
+      std::string key = (entry.key.type == eVALUE_NUMBER) ? "#" + Number_To_Text(entry.key.number) : "$" + Escape_Field(entry.key.Get_String());
+      cScript_Value& value = object[DICTIONARY_FIELD + key];
+      if (entry.value.type == eVALUE_STRING) {
+        value.Set_String("$" + Escape_Field(entry.value.Get_String()));
+      }
+      else {
+        value = entry.value;
+      }
+    }
+    return object;
+  }
+
+  /**
+   * Sets the fields from a loaded object. Dictionary entries, the fields
+   * marked "#" with a number or "$", are moved into the dictionary of the
+   * block. Other fields are kept as they are.
+   * @param object The loaded object.
+   */
+  void cBlock::Unpack_Fields(tObject& object) {
+    this->fields.Clear();
+    this->dict.reset();
+    int key_count = object.Count();
+    for (int key_index = 0; key_index < key_count; key_index++) {
+      std::string& name = object.keys[key_index];
+      cScript_Value key;
+      int number = 0;
+      bool entry = false;
+      if ((name.length() > 2) && (name[0] == DICTIONARY_FIELD) && (name[1] == '#') && Parse_Number(name.substr(2), number)) {
+        key.Set_Number(number);
+        entry = true;
+      }
+      else if ((name.length() >= 2) && (name[0] == DICTIONARY_FIELD) && (name[1] == '$')) {
+        key.Set_String(Unescape_Field(name.substr(2)));
+        entry = true;
+      }
+      if (entry) {
+        if (!this->dict) {
+          this->dict = std::make_shared<cDictionary>();
+        }
+        cScript_Value value = object.values[key_index];
+        const std::string& text = value.Get_String();
+        if ((value.type == eVALUE_STRING) && (text.length() > 0) && (text[0] == '$')) {
+          value.Set_String(Unescape_Field(text.substr(1)));
+        }
+        this->dict->Set(key, value);
+      }
+      else {
+        this->fields[name] = object.values[key_index];
+      }
+    }
+  }
+
+  // **************************************************************************
+  // Dictionary Implementation
+  // **************************************************************************
+
+  /**
+   * Creates an empty dictionary. Entries are kept dense in insertion
+   * order so they can be walked by index, and an open-addressing table
+   * of entry indices finds them by key.
+   */
+  cDictionary::cDictionary() {
+    this->slots = std::vector<int>(DICTIONARY_MINIMUM, -1);
+  }
+
+  /**
+   * Finds the value of a key.
+   * @param key The key.
+   * @return The value or NULL if the key is not in the dictionary.
+   */
+  cScript_Value* cDictionary::Find(cScript_Value key) {
+    int slot = this->Probe(key, this->Hash(key));
+    return (this->slots[slot] >= 0) ? &this->entries[this->slots[slot]].value : NULL;
+  }
+
+  /**
+   * Sets the value of a key. New keys are added at the end.
+   * @param key The key.
+   * @param value The value.
+   */
+  void cDictionary::Set(cScript_Value key, cScript_Value value) {
+    unsigned int hash = this->Hash(key);
+    int slot = this->Probe(key, hash);
+    if (this->slots[slot] >= 0) {
+      this->entries[this->slots[slot]].value = value;
+    }
+    else {
+      if (2 * ((int)this->entries.size() + 1) > (int)this->slots.size()) { // Keep the table at most half full.
+        this->Grow();
+        slot = this->Probe(key, hash);
+      }
+      this->slots[slot] = this->entries.size();
+      this->entries.push_back({ key, value, hash });
+    }
+  }
+
+  /**
+   * Removes a key. The last entry takes the place of the removed one, and
+   * the probe chain is shifted back so no tombstones are left.
+   * @param key The key.
+   * @return True if the key was removed, false if it was not there.
+   */
+  bool cDictionary::Remove(cScript_Value key) {
+    int slot = this->Probe(key, this->Hash(key));
+    int entry = this->slots[slot];
+    if (entry < 0) {
+      return false;
+    }
+    int mask = this->slots.size() - 1;
+    int hole = slot;
+    int next = (hole + 1) & mask;
+    while (this->slots[next] >= 0) {
+      int home = this->entries[this->slots[next]].hash & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask)) { // The hole is on its probe path.
+        this->slots[hole] = this->slots[next];
+        hole = next;
+      }
+      next = (next + 1) & mask;
+    }
+    this->slots[hole] = -1;
+    int last = this->entries.size() - 1;
+    if (entry != last) {
+      this->slots[this->Probe(this->entries[last].key, this->entries[last].hash)] = entry;
+      this->entries[entry] = this->entries[last];
+    }
+    this->entries.pop_back();
+    return true;
+  }
+
+  /**
+   * Gets the number of entries.
+   * @return The number of entries.
+   */
+  int cDictionary::Count() {
+    return this->entries.size();
+  }
+
+  /**
+   * Hashes a key. Strings hash by their text so runtime keys need not be
+   * interned. Entries keep their hash so it is only computed once.
+   * @param key The key.
+   * @return The hash.
+   */
+  unsigned int cDictionary::Hash(const cScript_Value& key) {
+    unsigned long long bits = (key.type == eVALUE_NUMBER) ? (unsigned int)key.number : Hash_Text(key.Get_String(), HASH_SEED);
+    return (unsigned int)((bits * 0x9E3779B97F4A7C15ULL) >> 32);
+  }
+
+  /**
+   * Tests if two keys are the same.
+   * @param left The first key.
+   * @param right The second key.
+   * @return True if the keys are the same, false otherwise.
+   */
+  bool cDictionary::Same_Key(const cScript_Value& left, const cScript_Value& right) {
+    if (left.type != right.type) {
+      return false;
+    }
+    return (left.type == eVALUE_NUMBER) ? (left.number == right.number) : left.Equals(right);
+  }
+
+  /**
+   * Finds the slot of a key with linear probing.
+   * @param key The key.
+   * @param hash The hash of the key.
+   * @return The slot holding the key or the empty slot where it belongs.
+   */
+  int cDictionary::Probe(const cScript_Value& key, unsigned int hash) {
+    int mask = this->slots.size() - 1;
+    int slot = hash & mask;
+    while ((this->slots[slot] >= 0) && ((this->entries[this->slots[slot]].hash != hash) || !this->Same_Key(this->entries[this->slots[slot]].key, key))) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  /**
+   * Doubles the number of slots and puts the entries back.
+   */
+  void cDictionary::Grow() {
+    this->slots = std::vector<int>(this->slots.size() * 2, -1);
+    int entry_count = this->entries.size();
+    for (int entry_index = 0; entry_index < entry_count; entry_index++) {
+      this->slots[this->Probe(this->entries[entry_index].key, this->entries[entry_index].hash)] = entry_index;
+    }
+  }
+
+  // **************************************************************************
+  // Simulator Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a new simulator.
+   * @param memory The memory module reference.
+   * @param io The I/O control module reference.
+   * @param program The start address if the program.
+   */
+  cSimulator::cSimulator(cMemory* memory, cIO_Control* io, int program) :
+    time_wheel(eWHEEL_TIME),
+    frame_wheel(eWHEEL_FRAMES),
+    calls(CALL_STACK_SLOTS, CALL_STACK_FRAMES) {
+    this->memory = memory;
+    this->io = io;
+    this->pointer = program;
+    this->status = eSTATUS_IDLE;
+    this->start_time = std::chrono::system_clock::now();
+    this->blocked = false;
+    this->wait_deadline = -1;
+    this->frame_done = false;
+    this->render_time = 0;
+    this->frame_stats = { 0, 0, 0, 0, 0, 0 };
+    this->clock = 0;
+    this->recorder = NULL;
+    this->io_worker = NULL;
+    this->text_buffer.reserve(TEXT_BUFFER_SIZE);
+    this->native_frame.count = 0;
+    this->native_frame.simulator = this;
+    this->view_width = 0;
+    this->view_height = 0;
+    this->worker = false;
+    this->element = -1;
+    this->list_address = -1;
+    this->list_count = 0;
+    this->scratch_address = -1;
+    this->pool = NULL;
+    this->frame_count = 0;
+    this->quota = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    this->usage = { 0, 0, 0, 0, 0, eFAULT_NONE, 0, 0 };
+  }
+
+  /**
+   * Frees the simulator. Pending saves are finished first.
+   */
+  cSimulator::~cSimulator() {
+    int instance_count = this->instances.size();
+    for (int instance_index = 0; instance_index < instance_count; instance_index++) {
+      delete this->instances[instance_index];
+    }
+    if (this->io_worker) {
+      delete this->io_worker;
+    }
+    int worker_count = this->workers.size();
+    for (int worker_index = 0; worker_index < worker_count; worker_index++) {
+      delete this->workers[worker_index];
+    }
+    if (this->pool) {
+      delete this->pool;
+    }
+  }
+
+  /**
+   * Runs the simulator. Returns early if the program blocks on a wait or
+   * refreshes the screen, which ends a frame.
+   * @param timeout The amount of milliseconds run the program for.
+   */
+  void cSimulator::Run(int timeout) {
+    auto start = std::chrono::system_clock::now();
+    this->blocked = false;
+    this->frame_done = false;
+    this->render_time = 0;
+    this->clock = this->Get_Time();
+    int count = 0;
+    if (this->recorder && (this->recorder->mode == eRECORD_REPLAY)) {
+      int limit = this->recorder->Get_Count();
+      this->recorder->Begin_Slice(this->clock, this->events, this->frame_stats);
+      this->Dispatch_Timers();
+      while ((this->status == eSTATUS_RUNNING) && (count < limit)) { // Same instructions as the recording.
+        this->Commit_IO();
+        cBlock& command = (*this->memory)[this->pointer++];
+        this->Command_Processor(command);
+        count++;
+      }
+      return;
+    }
+    if (this->recorder) {
+      this->recorder->Begin_Slice(this->clock, this->events, this->frame_stats);
+    }
+    this->Dispatch_Timers();
+    this->Poll_Input();
+    int limit = (this->quota.instructions > 0) ? this->quota.instructions : INT_MAX;
+    while (this->status == eSTATUS_RUNNING) {
+      auto end = std::chrono::system_clock::now();
+      auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+      if (count >= limit) { // Out of instructions for this slice.
+        this->usage.throttled++;
+        break;
+      }
+      if (diff.count() < timeout) {
+        this->Commit_IO();
+        cBlock& command = (*this->memory)[this->pointer++];
+        count++;
+        this->usage.instructions++;
+        this->Command_Processor(command);
+        if (this->blocked || this->frame_done) {
+          break;
+        }
+      }
+      else {
+        break;
+      }
+    }
+    if (this->recorder) {
+      this->recorder->End_Slice(count, this->clock);
+    }
+    this->metrics.instructions += count;
+    this->metrics.slices++;
+    this->metrics.slice_instructions.Observe(count);
+    if (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start).count() > timeout) {
+      this->metrics.overruns++;
+    }
+    if ((this->metrics.period > 0) && (this->clock - this->metrics.last_export >= this->metrics.period)) {
+      this->metrics.last_export = this->clock;
+      this->Export_Metrics();
+    }
+  }
+
+  /**
+   * Calls the labels of due timers. The calls are chained on the stack so
+   * each one returns into the next, in the order they came due, and the
+   * last returns to where the program was.
+   */
+  void cSimulator::Dispatch_Timers() {
+    this->due_timers.clear();
+    this->time_wheel.Advance(this->clock, this->due_timers);
+    this->frame_wheel.Advance(this->frame_count, this->due_timers);
+    for (int due_index = this->due_timers.size() - 1; due_index >= 0; due_index--) {
+      if (!this->Check_Stack()) {
+        break;
+      }
+      this->stack.Push(this->pointer);
+      this->return_marks.push_back(true);
+      this->pointer = this->due_timers[due_index];
+    }
+  }
+
+  /**
+   * Writes the metrics in the Prometheus text format. The file is written
+   * beside the real one and renamed over it so readers never see a
+   * partial file.
+   */
+  void cSimulator::Export_Metrics() {
+    int cells = 0;
+    for (int block_index = 0; block_index < this->memory->count; block_index++) {
+      cBlock& block = this->memory->memory[block_index];
+      if ((block.code != eCMD_NONE) || (block.fields.Count() > 0) || block.dict || (block.value.type != eVALUE_NUMBER) || (block.value.number != 0)) {
+        cells++;
+      }
+    }
+    std::string temp = this->metrics.file + ".tmp";
+    {
+      std::ofstream file(temp);
+      this->metrics.Write(file);
+      Write_Metric(file, "clsh_stack_depth", "gauge", "Items on the call stack.", this->stack.Count());
+      Write_Metric(file, "clsh_memory_cells_used", "gauge", "Memory cells that hold code or data.", cells);
+      Write_Metric(file, "clsh_memory_cells", "gauge", "Memory cells in total.", this->memory->count);
+      Write_Metric(file, "clsh_heap_blocks_used", "gauge", "Heap blocks handed out by alloc.", this->memory->heap.used);
+      Write_Metric(file, "clsh_heap_blocks_pooled", "gauge", "Freed heap blocks waiting in pools.", this->memory->heap.pooled);
+      Write_Metric(file, "clsh_input_events_queued", "gauge", "Input events waiting to be read.", this->events.size());
+      Write_Metric(file, "clsh_timers_pending", "gauge", "Timers waiting to fire.", this->time_wheel.active + this->frame_wheel.active);
+      if (!file) {
+        return;
+      }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp, this->metrics.file, error);
+  }
+
+  /**
+   * Stops the program because it went over a quota. The fault is kept in
+   * the usage so the host can tell why the program stopped.
+   * @param fault The quota that was exceeded.
+   */
+  void cSimulator::Fault(int fault) {
+    static const char* names[] = { "none", "stack", "string", "fields", "read", "written", "memory", "instances" };
+    if (this->usage.fault == eFAULT_NONE) {
+      std::cout << "Quota exceeded: " << names[fault] << "." << std::endl;
+    }
+    this->usage.fault = fault;
+    this->status = eSTATUS_DONE;
+  }
+
+  /**
+   * Checks that the stack has room for one more item.
+   * @return True if there is room, false if the program faulted.
+   */
+  bool cSimulator::Check_Stack() {
+    int depth = this->stack.Count() + this->calls.count; // The root frame stands for the new item.
+    this->usage.stack = std::max(this->usage.stack, depth);
+    if ((this->quota.stack > 0) && (depth > this->quota.stack)) {
+      this->Fault(eFAULT_STACK);
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Checks the number of fields of an object.
+   * @param object The object.
+   * @return True if the object is within the quota, false if the program
+   * faulted.
+   */
+  bool cSimulator::Check_Fields(tObject& object) {
+    if ((this->quota.fields > 0) && (object.Count() > this->quota.fields)) {
+      this->Fault(eFAULT_FIELDS);
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Charges a spawned instance against the memory and instance quotas.
+   * @param size The number of blocks of the instance.
+   * @return True if the instance may be spawned, false if the program
+   * faulted.
+   */
+  bool cSimulator::Charge_Spawn(int size) {
+    if ((this->quota.instances > 0) && (this->usage.instances + 1 > this->quota.instances)) {
+      this->Fault(eFAULT_INSTANCES);
+      return false;
+    }
+    if ((this->quota.memory > 0) && (this->usage.memory + size > this->quota.memory)) {
+      this->Fault(eFAULT_MEMORY);
+      return false;
+    }
+    this->usage.instances++;
+    this->usage.memory += size;
+    return true;
+  }
+
+  /**
+   * Charges the size of a file against the read quota before it is read.
+   * @param name The name of the file.
+   * @return True if the file may be read, false if the program faulted.
+   */
+  bool cSimulator::Charge_Read(std::string name) {
+    long long size = Get_File_Size(name) + Get_File_Size(name + ".journal");
+    if ((this->quota.read > 0) && (this->usage.read + size > this->quota.read)) {
+      this->Fault(eFAULT_READ);
+      return false;
+    }
+    this->usage.read += size;
+    return true;
+  }
+
+  /**
+   * Checks the write quota before a save. The size of a save is only known
+   * after it is written, so the save that crosses the quota completes and
+   * the next one faults.
+   * @return True if the save may go ahead, false if the program faulted.
+   */
+  bool cSimulator::Check_Write() {
+    if ((this->quota.written > 0) && (this->usage.written >= this->quota.written)) {
+      this->Fault(eFAULT_WRITE);
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Moves pending input signals into the event queue. The oldest events
+   * are dropped if the queue is full.
+   */
+  void cSimulator::Poll_Input() {
+    for (int poll_index = 0; poll_index < INPUT_POLL_LIMIT; poll_index++) {
+      int code = this->io->Read_Signal().code;
+      if (code == INPUT_NONE) {
+        break;
+      }
+      sInput_Event event;
+      event.code = code;
+      event.time = this->clock;
+      this->events.push_back(event);
+      if (this->recorder) {
+        this->recorder->Record_Event(code);
+      }
+      if (this->events.size() > INPUT_QUEUE_LIMIT) {
+        this->events.pop_front();
+      }
+    }
+  }
+
+  /**
+   * Gets the time since the simulator was created.
+   * @return The time in milliseconds.
+   */
+  long long cSimulator::Get_Time() {
+    auto now = std::chrono::system_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now - this->start_time).count();
+  }
+
+  /**
+   * Gets a random number. Draws are recorded or replayed.
+   * @param lower The lower bound.
+   * @param upper The upper bound.
+   * @return The random number.
+   */
+  int cSimulator::Get_Random(int lower, int upper) {
+    int number = 0;
+    if (this->worker) {
+      throw cError("Random numbers are not available in parallel each.");
+    }
+    else if (this->recorder) {
+      number = this->recorder->Random(lower, upper, this->io);
+    }
+    else {
+      number = this->io->Get_Random_Number(lower, upper);
+    }
+    return number;
+  }
+
+  /**
+   * Runs the command processor.
+   * @param command The command to process.
+   * @throws An error if the command is invalid.
+   */
+  void cSimulator::Command_Processor(cBlock& command) {
     switch (command.code) {
       case eCMD_NONE: {
         break; // Do nothing.
       }
       case eCMD_STORE: {
-        cValue result = this->Eval_Expression(command, 0);
-        cValue pointer = this->Eval_Expression(command, 1);
-        cBlock& block = (*this->memory)[pointer.number];
+        cScript_Value result = this->Eval_Expression(command, 0);
+        cScript_Value pointer = this->Eval_Expression(command, 1);
+        cBlock& block = this->Write_Block(pointer.number);
         block.value = result;
         break;
       }
       case eCMD_SET: {
-        cValue pointer = this->Eval_Expression(command, 0); // Pointer
-        cValue field = this->Eval_Expression(command, 1); // Field
-        cValue value = this->Eval_Expression(command, 2); // Value
-        cBlock& block = (*this->memory)[pointer.number];
-        block.fields[field.string] = value;
+        cScript_Value pointer = this->Eval_Expression(command, 0); // Pointer
+        cScript_Value field = this->Eval_Expression(command, 1); // Field
+        cScript_Value value = this->Eval_Expression(command, 2); // Value
+        cBlock& block = this->Write_Block(pointer.number);
+        if ((this->quota.fields > 0) && (block.fields.Count() >= this->quota.fields) && !block.fields.Does_Key_Exist(field.Get_String())) {
+          this->Fault(eFAULT_FIELDS);
+          break;
+        }
+        block.fields[field.Get_String()] = value;
         break;
       }
       case eCMD_TEST: {
         int result = this->Eval_Conditional(command);
-        cValue passed_address = this->Eval_Expression(command, command.expressions.Count() - 2);
-        cValue failed_address = this->Eval_Expression(command, command.expressions.Count() - 1);
+        cScript_Value passed_address = this->Eval_Expression(command, command.expressions.Count() - 2);
+        cScript_Value failed_address = this->Eval_Expression(command, command.expressions.Count() - 1);
         if (result) {
           if (passed_address.number != TAKE_NO_JUMP) {
             this->pointer = passed_address.number;
@@ -796,13 +2547,18 @@ namespace Codeloader {
         break;
       }
       case eCMD_CALL: {
-        cValue jump_address = this->Eval_Expression(command, 0);
+        cScript_Value jump_address = this->Eval_Expression(command, 0);
+        if (!this->Check_Stack()) {
+          break;
+        }
         this->stack.Push(this->pointer); // Save next command address.
+        this->return_marks.push_back(true);
         this->pointer = jump_address.number;
         break;
       }
       case eCMD_RETURN: {
         this->pointer = this->stack.Pop();
+        this->return_marks.pop_back();
         break;
       }
       case eCMD_STOP: {
@@ -810,99 +2566,619 @@ namespace Codeloader {
         break;
       }
       case eCMD_OUTPUT: {
-        cValue string = this->Eval_Expression(command, 0);
-        cValue x = this->Eval_Expression(command, 1);
-        cValue y = this->Eval_Expression(command, 2);
-        cValue red = this->Eval_Expression(command, 3);
-        cValue green = this->Eval_Expression(command, 4);
-        cValue blue = this->Eval_Expression(command, 5);
-        this->io->Output_Text(string.string, x.number, y.number, red.number, green.number, blue.number);
+        cScript_Value string = this->Eval_Expression(command, 0);
+        cScript_Value x = this->Eval_Expression(command, 1);
+        cScript_Value y = this->Eval_Expression(command, 2);
+        cScript_Value red = this->Eval_Expression(command, 3);
+        cScript_Value green = this->Eval_Expression(command, 4);
+        cScript_Value blue = this->Eval_Expression(command, 5);
+        this->io->Output_Text(string.Get_String(), x.number, y.number, red.number, green.number, blue.number);
+        this->metrics.frame_draws++;
         break;
       }
       case eCMD_DRAW: {
-        cValue name = this->Eval_Expression(command, 0);
-        cValue x = this->Eval_Expression(command, 1);
-        cValue y = this->Eval_Expression(command, 2);
-        cValue width = this->Eval_Expression(command, 3);
-        cValue height = this->Eval_Expression(command, 4);
-        cValue angle = this->Eval_Expression(command, 5);
-        cValue flip_x = this->Eval_Expression(command, 6);
-        cValue flip_y = this->Eval_Expression(command, 7);
-        this->io->Draw_Image(name.string, x.number, y.number, width.number, height.number, angle.number, flip_x.number, flip_y.number);
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value x = this->Eval_Expression(command, 1);
+        cScript_Value y = this->Eval_Expression(command, 2);
+        cScript_Value width = this->Eval_Expression(command, 3);
+        cScript_Value height = this->Eval_Expression(command, 4);
+        cScript_Value angle = this->Eval_Expression(command, 5);
+        cScript_Value flip_x = this->Eval_Expression(command, 6);
+        cScript_Value flip_y = this->Eval_Expression(command, 7);
+        this->io->Draw_Image(name.Get_String(), x.number, y.number, width.number, height.number, angle.number, flip_x.number, flip_y.number);
+        this->metrics.frame_draws++;
         break;
       }
-      case eCMD_REFRESH: {
-        this->io->Refresh();
+      case eCMD_DRAW_MAP: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value columns = this->Eval_Expression(command, 1);
+        cScript_Value rows = this->Eval_Expression(command, 2);
+        cScript_Value tile_size = this->Eval_Expression(command, 3);
+        cScript_Value tileset = this->Eval_Expression(command, 4);
+        cScript_Value camera_x = this->Eval_Expression(command, 5);
+        cScript_Value camera_y = this->Eval_Expression(command, 6);
+        this->Draw_Map(pointer.number, columns.number, rows.number, tile_size.number, tileset.Get_String(), camera_x.number, camera_y.number);
         break;
       }
-      case eCMD_SOUND: {
-        cValue name = this->Eval_Expression(command, 0);
-        this->io->Play_Sound(name.string);
+      case eCMD_SPATIAL_BUILD: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value count = this->Eval_Expression(command, 1);
+        cScript_Value cell_size = this->Eval_Expression(command, 2);
+        this->spatial.Build(this->memory, pointer.number, count.number, cell_size.number);
         break;
       }
-      case eCMD_MUSIC: {
-        cValue name = this->Eval_Expression(command, 0);
-        this->io->Play_Music(name.string);
+      case eCMD_SPATIAL_UPDATE: {
+        this->spatial.Update(this->memory);
         break;
       }
-      case eCMD_SILENCE: {
-        this->io->Silence();
+      case eCMD_SPATIAL_OVERLAPS: {
+        cScript_Value object = this->Eval_Expression(command, 0);
+        cScript_Value pointer = this->Eval_Expression(command, 1);
+        cScript_Value limit = this->Eval_Expression(command, 2);
+        int index = object.number - this->spatial.address;
+        this->spatial_results.clear();
+        if ((index >= 0) && (index < this->spatial.count)) {
+          sSpatial_Entry& entry = this->spatial.entries[index];
+          this->spatial.Query(entry.x, entry.y, entry.width, entry.height, index, this->spatial_results);
+        }
+        this->Write_Results(pointer.number, limit.number);
         break;
       }
-      case eCMD_INPUT: {
-        cValue pointer = this->Eval_Expression(command, 0);
-        cBlock& block = (*this->memory)[pointer.number];
-        block.value.Set_Number(this->io->Read_Signal().code);
+      case eCMD_SPATIAL_POINT: {
+        cScript_Value x = this->Eval_Expression(command, 0);
+        cScript_Value y = this->Eval_Expression(command, 1);
+        cScript_Value pointer = this->Eval_Expression(command, 2);
+        cScript_Value limit = this->Eval_Expression(command, 3);
+        this->spatial_results.clear();
+        this->spatial.Query(x.number, y.number, 1, 1, -1, this->spatial_results);
+        this->Write_Results(pointer.number, limit.number);
         break;
       }
-      case eCMD_TIMEOUT: {
-        cValue timeout = this->Eval_Expression(command, 0);
-        this->io->Timeout(timeout.number);
+      case eCMD_SPATIAL_RECT: {
+        cScript_Value x = this->Eval_Expression(command, 0);
+        cScript_Value y = this->Eval_Expression(command, 1);
+        cScript_Value width = this->Eval_Expression(command, 2);
+        cScript_Value height = this->Eval_Expression(command, 3);
+        cScript_Value pointer = this->Eval_Expression(command, 4);
+        cScript_Value limit = this->Eval_Expression(command, 5);
+        this->spatial_results.clear();
+        this->spatial.Query(x.number, y.number, width.number, height.number, -1, this->spatial_results);
+        this->Write_Results(pointer.number, limit.number);
         break;
       }
-      case eCMD_COLOR: {
-        cValue red = this->Eval_Expression(command, 0);
-        cValue green = this->Eval_Expression(command, 1);
-        cValue blue = this->Eval_Expression(command, 2);
-        this->io->Color(red.number, green.number, blue.number);
+      case eCMD_FIND_PATH: {
+        cScript_Value grid = this->Eval_Expression(command, 0);
+        cScript_Value columns = this->Eval_Expression(command, 1);
+        cScript_Value rows = this->Eval_Expression(command, 2);
+        cScript_Value start_x = this->Eval_Expression(command, 3);
+        cScript_Value start_y = this->Eval_Expression(command, 4);
+        cScript_Value goal_x = this->Eval_Expression(command, 5);
+        cScript_Value goal_y = this->Eval_Expression(command, 6);
+        cScript_Value pointer = this->Eval_Expression(command, 7);
+        cScript_Value limit = this->Eval_Expression(command, 8);
+        cScript_Value budget = this->Eval_Expression(command, 9);
+        int start = ((start_x.number >= 0) && (start_x.number < columns.number)) ? (start_y.number * columns.number) + start_x.number : -1;
+        int goal = ((goal_x.number >= 0) && (goal_x.number < columns.number)) ? (goal_y.number * columns.number) + goal_x.number : -1;
+        int result = this->pathfinder.Find_Path(this->memory, pointer.number, grid.number, columns.number, rows.number, start, goal, budget.number);
+        if (result >= 0) { // Write the steps after the start, up to the max.
+          int step_count = std::min(result, std::max(limit.number, 0));
+          for (int step_index = 0; step_index < step_count; step_index++) {
+            this->Write_Block(pointer.number + 1 + step_index).value.Set_Number(this->pathfinder.path[step_index]);
+          }
+        }
+        this->Write_Block(pointer.number).value.Set_Number(result);
         break;
       }
-      case eCMD_LOAD: {
-        cValue name = this->Eval_Expression(command, 0);
-        cValue address = this->Eval_Expression(command, 1);
-        cValue count = this->Eval_Expression(command, 2);
-        cBlock& block = (*this->memory)[address.number];
-        block.value.Set_Number(this->Load(name.string, this->memory, address.number));
+      case eCMD_FLOW_FIELD: {
+        cScript_Value grid = this->Eval_Expression(command, 0);
+        cScript_Value columns = this->Eval_Expression(command, 1);
+        cScript_Value rows = this->Eval_Expression(command, 2);
+        cScript_Value goal_x = this->Eval_Expression(command, 3);
+        cScript_Value goal_y = this->Eval_Expression(command, 4);
+        cScript_Value pointer = this->Eval_Expression(command, 5);
+        int goal = ((goal_x.number >= 0) && (goal_x.number < columns.number)) ? (goal_y.number * columns.number) + goal_x.number : -1;
+        this->pathfinder.Flow_Field(this->memory, grid.number, columns.number, rows.number, goal);
+        int cell_count = this->pathfinder.directions.size();
+        if (cell_count > 0) {
+          this->Read_Block(pointer.number + cell_count - 1); // Check the end of the list.
+        }
+        for (int cell_index = 0; cell_index < cell_count; cell_index++) {
+          this->Write_Block(pointer.number + cell_index).value.Set_Number(this->pathfinder.directions[cell_index]);
+        }
         break;
       }
-      case eCMD_SAVE: {
-        cValue name = this->Eval_Expression(command, 0);
-        cValue address = this->Eval_Expression(command, 1);
-        cValue count = this->Eval_Expression(command, 2);
-        this->Save(name.string, this->memory, address.number, count.number);
+      case eCMD_PARALLEL_EACH: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value count = this->Eval_Expression(command, 1);
+        cScript_Value routine = this->Eval_Expression(command, 2);
+        cScript_Value scratch = this->Eval_Expression(command, 3);
+        cScript_Value size = this->Eval_Expression(command, 4);
+        if (this->worker) {
+          this->Generate_Execution_Error("Parallel each cannot be nested.", command);
+        }
+        this->Parallel_Each(pointer.number, count.number, routine.number, scratch.number, size.number);
         break;
       }
-      case eCMD_PUSH: {
-        cValue result = this->Eval_Expression(command, 0);
-        this->stack.Push(result.number);
+      case eCMD_CHANNEL: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value size = this->Eval_Expression(command, 1);
+        cScript_Value producers = this->Eval_Expression(command, 2);
+        this->channels[name.Get_String()] = channel_hub.Open(name.Get_String(), (producers.number > 1) ? eCHANNEL_MULTI : eCHANNEL_SINGLE, command.value.number, size.number);
         break;
       }
-      case eCMD_POP: {
-        cValue pointer = this->Eval_Expression(command, 0);
-        cBlock& block = (*this->memory)[pointer.number];
-        block.value.Set_Number(this->stack.Pop());
+      case eCMD_SEND: {
+        cScript_Value value = this->Eval_Expression(command, 0);
+        cScript_Value name = this->Eval_Expression(command, 1);
+        if (!this->Send_Message(name.Get_String(), value)) { // Full so wait.
+          this->blocked = true;
+          this->pointer--; // Send again on the next run.
+        }
         break;
       }
-      case eCMD_REPEAT: {
-        cValue lower = this->Eval_Expression(command, 0);
-        cValue upper = this->Eval_Expression(command, 1);
-        cValue pointer = this->Eval_Expression(command, 2);
-        cValue jump_address = this->Eval_Expression(command, 3);
-        cBlock& var = (*this->memory)[pointer.number];
-        if ((var.value.number < lower.number) || (var.value.number > upper.number)) { // Reset variable if out of bounds.
-          var.value.Set_Number(lower.number++);
-          this->pointer = jump_address.number; // Jump to loop location.
-        }
+      case eCMD_TRY_SEND: {
+        cScript_Value value = this->Eval_Expression(command, 0);
+        cScript_Value name = this->Eval_Expression(command, 1);
+        cScript_Value status = this->Eval_Expression(command, 2);
+        bool sent = this->Send_Message(name.Get_String(), value);
+        this->Write_Block(status.number).value.Set_Number(sent ? 1 : 0);
+        break;
+      }
+      case eCMD_RECEIVE: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value pointer = this->Eval_Expression(command, 1);
+        cScript_Value message;
+        if (this->Receive_Message(name.Get_String(), message)) {
+          this->Write_Block(pointer.number).value = message;
+        }
+        else { // Empty so wait.
+          this->blocked = true;
+          this->pointer--; // Receive again on the next run.
+        }
+        break;
+      }
+      case eCMD_TRY_RECEIVE: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value pointer = this->Eval_Expression(command, 1);
+        cScript_Value status = this->Eval_Expression(command, 2);
+        cScript_Value message;
+        bool received = this->Receive_Message(name.Get_String(), message);
+        if (received) {
+          this->Write_Block(pointer.number).value = message;
+        }
+        this->Write_Block(status.number).value.Set_Number(received ? 1 : 0);
+        break;
+      }
+      case eCMD_SPAWN: {
+        cScript_Value program = this->Eval_Expression(command, 0);
+        cScript_Value size = this->Eval_Expression(command, 1);
+        cScript_Value start = this->Eval_Expression(command, 2);
+        int next = 3;
+        int heap_size = 0; // Heap above the program unless sized.
+        if (command.value.number == 1) {
+          heap_size = this->Eval_Expression(command, next++).number;
+        }
+        sQuota quota = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        if (command.expressions.Count() > next) { // Unset fields are unlimited.
+          cScript_Value pointer = this->Eval_Expression(command, next);
+          tObject& fields = this->Read_Block(pointer.number).fields;
+          quota.instructions = fields.Does_Key_Exist("instructions") ? fields["instructions"].number : 0;
+          quota.stack = fields.Does_Key_Exist("stack") ? fields["stack"].number : 0;
+          quota.string = fields.Does_Key_Exist("string") ? fields["string"].number : 0;
+          quota.fields = fields.Does_Key_Exist("fields") ? fields["fields"].number : 0;
+          quota.read = fields.Does_Key_Exist("read") ? fields["read"].number : 0;
+          quota.written = fields.Does_Key_Exist("written") ? fields["written"].number : 0;
+          quota.memory = fields.Does_Key_Exist("memory") ? fields["memory"].number : 0;
+          quota.instances = fields.Does_Key_Exist("instances") ? fields["instances"].number : 0;
+        }
+        if ((size.number < 1) || (size.number > SPAWN_MEMORY_LIMIT) || (start.number < 0) || (start.number >= size.number)) {
+          this->Generate_Execution_Error("Spawned memory must be 1 to " + Number_To_Text(SPAWN_MEMORY_LIMIT) + " blocks with the start inside it.", command);
+        }
+        if ((int)this->instances.size() >= SPAWN_INSTANCE_LIMIT) {
+          this->Generate_Execution_Error("Cannot spawn more than " + Number_To_Text(SPAWN_INSTANCE_LIMIT) + " instances.", command);
+        }
+        if (!this->Charge_Spawn(size.number)) {
+          break;
+        }
+        if (this->recorder && (this->recorder->mode == eRECORD_REPLAY)) { // Its messages come from the log.
+          break;
+        }
+        this->instances.push_back(new cInstance(program.Get_String(), size.number, start.number, heap_size, quota));
+        break;
+      }
+      case eCMD_QUOTA_USAGE: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cBlock& block = this->Write_Block(pointer.number);
+        block.fields["instructions"].Set_Number(this->usage.instructions);
+        block.fields["stack"].Set_Number(std::max(this->usage.stack, this->stack.Count()));
+        block.fields["read"].Set_Number(this->usage.read);
+        block.fields["written"].Set_Number(this->usage.written);
+        block.fields["throttled"].Set_Number(this->usage.throttled);
+        block.fields["fault"].Set_Number(this->usage.fault);
+        block.fields["memory"].Set_Number(this->usage.memory);
+        block.fields["instances"].Set_Number(this->usage.instances);
+        break;
+      }
+      case eCMD_SCHEDULE: {
+        cScript_Value address = this->Eval_Expression(command, 0);
+        cScript_Value delay = this->Eval_Expression(command, 1);
+        cScript_Value pointer = this->Eval_Expression(command, 2);
+        int handle = this->time_wheel.Schedule(address.number, this->clock + delay.number);
+        this->Write_Block(pointer.number).value.Set_Number(handle);
+        break;
+      }
+      case eCMD_SCHEDULE_FRAMES: {
+        cScript_Value address = this->Eval_Expression(command, 0);
+        cScript_Value delay = this->Eval_Expression(command, 1);
+        cScript_Value pointer = this->Eval_Expression(command, 2);
+        int handle = this->frame_wheel.Schedule(address.number, this->frame_count + delay.number);
+        this->Write_Block(pointer.number).value.Set_Number(handle);
+        break;
+      }
+      case eCMD_CANCEL: {
+        cScript_Value handle = this->Eval_Expression(command, 0);
+        if (((handle.number >> 20) & 1) == eWHEEL_FRAMES) {
+          this->frame_wheel.Cancel(handle.number);
+        }
+        else {
+          this->time_wheel.Cancel(handle.number);
+        }
+        break;
+      }
+      case eCMD_INVOKE:
+      case eCMD_TAIL_INVOKE: {
+        cScript_Value jump_address = this->Eval_Expression(command, 0);
+        int arg_count = command.value.number;
+        int result = -1;
+        if (command.expressions.Count() > arg_count + 1) {
+          cScript_Value slot = this->Eval_Expression(command, arg_count + 1);
+          result = this->calls.Get_Slot(slot.number);
+        }
+        int top = this->calls.Get_Top();
+        if (top + arg_count > (int)this->calls.slots.size()) {
+          this->Generate_Execution_Error("Call stack overflow.", command);
+        }
+        for (int arg_index = 0; arg_index < arg_count; arg_index++) { // Arguments go above the current frame.
+          this->calls.slots[top + arg_index] = this->Eval_Expression(command, arg_index + 1);
+        }
+        if (command.code == eCMD_TAIL_INVOKE) {
+          this->calls.Tail(arg_count);
+        }
+        else {
+          if (!this->Check_Stack()) {
+            break;
+          }
+          if (!this->calls.Push(arg_count, this->pointer, result)) {
+            this->Generate_Execution_Error("Call stack overflow.", command);
+          }
+        }
+        this->pointer = jump_address.number;
+        break;
+      }
+      case eCMD_ENTER: {
+        cScript_Value size = this->Eval_Expression(command, 0);
+        if (!this->calls.Resize(size.number)) {
+          this->Generate_Execution_Error("Call stack overflow.", command);
+        }
+        break;
+      }
+      case eCMD_LEAVE: {
+        if (this->calls.count == 1) {
+          this->Generate_Execution_Error("Leave without invoke.", command);
+        }
+        if (command.expressions.Count() > 0) {
+          cScript_Value result = this->Eval_Expression(command, 0);
+          sFrame& frame = this->calls.Top();
+          if (frame.result >= 0) {
+            this->calls.slots[frame.result] = result;
+          }
+        }
+        this->pointer = this->calls.Pop().return_address;
+        break;
+      }
+      case eCMD_STORE_LOCAL: {
+        cScript_Value result = this->Eval_Expression(command, 0);
+        cScript_Value slot = this->Eval_Expression(command, 1);
+        this->calls.slots[this->calls.Get_Slot(slot.number)] = result;
+        break;
+      }
+      case eCMD_ALLOC:
+      case eCMD_SCRATCH: {
+        cScript_Value size = this->Eval_Expression(command, 0);
+        cScript_Value pointer = this->Eval_Expression(command, 1);
+        int address = (command.code == eCMD_ALLOC) ? this->memory->Allocate(size.number) : this->memory->Allocate_Scratch(size.number);
+        this->Write_Block(pointer.number).value.Set_Number(address);
+        break;
+      }
+      case eCMD_FREE: {
+        cScript_Value address = this->Eval_Expression(command, 0);
+        if (!this->memory->Free(address.number)) {
+          this->Generate_Execution_Error("Address " + Number_To_Text(address.number) + " was not allocated.", command);
+        }
+        break;
+      }
+      case eCMD_MARK: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        this->Write_Block(pointer.number).value.Set_Number(this->memory->arena_top);
+        break;
+      }
+      case eCMD_RELEASE: {
+        cScript_Value mark = this->Eval_Expression(command, 0);
+        if (!this->memory->Release(mark.number)) {
+          this->Generate_Execution_Error("Invalid scratch mark " + Number_To_Text(mark.number) + ".", command);
+        }
+        break;
+      }
+      case eCMD_HEAP_STATS: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        sHeap_Stats& heap = this->memory->heap;
+        int open = this->memory->arena_top - this->memory->heap_top;
+        cBlock& block = this->Write_Block(pointer.number);
+        block.fields["used"].Set_Number(heap.used);
+        block.fields["wasted"].Set_Number(heap.used - heap.requested);
+        block.fields["pooled"].Set_Number(heap.pooled);
+        block.fields["open"].Set_Number(open);
+        block.fields["scratch"].Set_Number(this->memory->count - this->memory->arena_top);
+        block.fields["allocs"].Set_Number(heap.allocs);
+        block.fields["frees"].Set_Number(heap.frees);
+        block.fields["failures"].Set_Number(heap.failures);
+        block.fields["fragmentation"].Set_Number((heap.pooled + open > 0) ? (100 * heap.pooled) / (heap.pooled + open) : 0); // Percent of free blocks stuck in pools.
+        break;
+      }
+      case eCMD_DICT_SET: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value key = this->Eval_Expression(command, 1);
+        cScript_Value value = this->Eval_Expression(command, 2);
+        cBlock& block = this->Write_Block(pointer.number);
+        if (!block.dict) {
+          block.dict = std::make_shared<cDictionary>();
+        }
+        if ((this->quota.fields > 0) && (block.dict->Count() >= this->quota.fields) && !block.dict->Find(key)) {
+          this->Fault(eFAULT_FIELDS);
+          break;
+        }
+        block.dict->Set(key, value);
+        break;
+      }
+      case eCMD_DICT_GET:
+      case eCMD_DICT_HAS: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value key = this->Eval_Expression(command, 1);
+        cScript_Value dest = this->Eval_Expression(command, 2);
+        cBlock& block = this->Read_Block(pointer.number);
+        cScript_Value* value = block.dict ? block.dict->Find(key) : NULL;
+        if (command.code == eCMD_DICT_HAS) {
+          this->Write_Block(dest.number).value.Set_Number(value ? 1 : 0);
+        }
+        else if (value) {
+          this->Write_Block(dest.number).value = *value;
+        }
+        else if (command.expressions.Count() > 3) {
+          this->Write_Block(dest.number).value = this->Eval_Expression(command, 3);
+        }
+        else {
+          this->Generate_Execution_Error("Could not find key " + (key.type == eVALUE_NUMBER ? Number_To_Text(key.number) : key.Get_String()) + ".", command);
+        }
+        break;
+      }
+      case eCMD_DICT_REMOVE: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value key = this->Eval_Expression(command, 1);
+        cBlock& block = this->Write_Block(pointer.number);
+        if (block.dict) {
+          block.dict->Remove(key);
+        }
+        break;
+      }
+      case eCMD_DICT_COUNT: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value dest = this->Eval_Expression(command, 1);
+        cBlock& block = this->Read_Block(pointer.number);
+        this->Write_Block(dest.number).value.Set_Number(block.dict ? block.dict->Count() : 0);
+        break;
+      }
+      case eCMD_DICT_ENTRY: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value index = this->Eval_Expression(command, 1);
+        cScript_Value key_dest = this->Eval_Expression(command, 2);
+        cScript_Value value_dest = this->Eval_Expression(command, 3);
+        cBlock& block = this->Read_Block(pointer.number);
+        if (!block.dict || (index.number < 0) || (index.number >= block.dict->Count())) {
+          this->Generate_Execution_Error("Dictionary index " + Number_To_Text(index.number) + " is out of range.", command);
+        }
+        sDictionary_Entry& entry = block.dict->entries[index.number];
+        this->Write_Block(key_dest.number).value = entry.key;
+        this->Write_Block(value_dest.number).value = entry.value;
+        break;
+      }
+      case eCMD_DICT_CLEAR: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        this->Write_Block(pointer.number).dict.reset();
+        break;
+      }
+      case eCMD_REFRESH: {
+        auto start = std::chrono::steady_clock::now();
+        this->io->Refresh();
+        auto end = std::chrono::steady_clock::now();
+        this->render_time += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        this->frame_done = true;
+        this->frame_count++;
+        this->metrics.Refresh();
+        break;
+      }
+      case eCMD_SOUND: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        this->io->Play_Sound(name.Get_String());
+        break;
+      }
+      case eCMD_MUSIC: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        this->io->Play_Music(name.Get_String());
+        break;
+      }
+      case eCMD_SILENCE: {
+        this->io->Silence();
+        break;
+      }
+      case eCMD_INPUT: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cBlock& block = this->Write_Block(pointer.number);
+        if (this->events.size() > 0) {
+          block.value.Set_Number(this->events.front().code);
+          this->events.pop_front();
+        }
+        else {
+          block.value.Set_Number(INPUT_NONE);
+        }
+        break;
+      }
+      case eCMD_INPUT_EVENTS: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value count = this->Eval_Expression(command, 1);
+        int event_count = 0;
+        while ((event_count < count.number) && (this->events.size() > 0)) {
+          cBlock& item = this->Write_Block(pointer.number + 1 + event_count);
+          item.value.Set_Number(this->events.front().code);
+          item.fields["time"].Set_Number(this->events.front().time);
+          this->events.pop_front();
+          event_count++;
+        }
+        this->Write_Block(pointer.number).value.Set_Number(event_count);
+        break;
+      }
+      case eCMD_INPUT_WAIT: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value timeout = this->Eval_Expression(command, 1);
+        cBlock& block = this->Write_Block(pointer.number);
+        if (this->events.size() > 0) {
+          block.value.Set_Number(this->events.front().code);
+          this->events.pop_front();
+          this->wait_deadline = -1;
+        }
+        else if ((this->wait_deadline >= 0) && (this->clock >= this->wait_deadline)) { // Timed out.
+          block.value.Set_Number(INPUT_NONE);
+          this->wait_deadline = -1;
+        }
+        else {
+          if (this->wait_deadline < 0) {
+            this->wait_deadline = (timeout.number < 0) ? LLONG_MAX : this->clock + timeout.number;
+          }
+          this->blocked = true;
+          this->pointer--; // Wait again on the next run.
+        }
+        break;
+      }
+      case eCMD_TIMEOUT: {
+        cScript_Value timeout = this->Eval_Expression(command, 0);
+        this->io->Timeout(timeout.number);
+        break;
+      }
+      case eCMD_COLOR: {
+        cScript_Value red = this->Eval_Expression(command, 0);
+        cScript_Value green = this->Eval_Expression(command, 1);
+        cScript_Value blue = this->Eval_Expression(command, 2);
+        this->io->Color(red.number, green.number, blue.number);
+        break;
+      }
+      case eCMD_LOAD: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value address = this->Eval_Expression(command, 1);
+        cScript_Value count = this->Eval_Expression(command, 2);
+        cBlock& block = this->Write_Block(address.number);
+        block.value.Set_Number(this->Load(name.Get_String(), this->memory, address.number));
+        break;
+      }
+      case eCMD_SAVE: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value address = this->Eval_Expression(command, 1);
+        cScript_Value count = this->Eval_Expression(command, 2);
+        this->Save(name.Get_String(), this->memory, address.number, count.number);
+        break;
+      }
+      case eCMD_CALL_NATIVE: {
+        sNative_Frame& frame = this->native_frame;
+        frame.count = command.expressions.Count() - 1;
+        for (int arg_index = 0; arg_index < frame.count; arg_index++) {
+          frame.args[arg_index] = this->Eval_Expression(command, arg_index);
+        }
+        frame.result.Set_Number(0);
+        native_registry.functions[command.value.number](frame);
+        cScript_Value pointer = this->Eval_Expression(command, frame.count);
+        this->Write_Block(pointer.number).value = frame.result;
+        break;
+      }
+      case eCMD_SAVE_CHANGES: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value address = this->Eval_Expression(command, 1);
+        cScript_Value count = this->Eval_Expression(command, 2);
+        this->Save_Changes(name.Get_String(), address.number, count.number);
+        break;
+      }
+      case eCMD_LOAD_ASYNC: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value address = this->Eval_Expression(command, 1);
+        cScript_Value count = this->Eval_Expression(command, 2);
+        cScript_Value status = this->Eval_Expression(command, 3);
+        sIO_Job job;
+        job.type = eIO_LOAD;
+        job.name = name.Get_String();
+        job.address = address.number;
+        job.status = status.number;
+        this->Start_IO(job);
+        break;
+      }
+      case eCMD_SAVE_ASYNC: {
+        cScript_Value name = this->Eval_Expression(command, 0);
+        cScript_Value address = this->Eval_Expression(command, 1);
+        cScript_Value count = this->Eval_Expression(command, 2);
+        cScript_Value status = this->Eval_Expression(command, 3);
+        sIO_Job job;
+        job.type = eIO_SAVE;
+        job.name = name.Get_String();
+        job.address = address.number;
+        job.status = status.number;
+        if (this->saves.Does_Key_Exist(name.Get_String())) { // A full save starts a new journal.
+          this->saves[name.Get_String()].count = -1;
+        }
+        for (int block_index = 0; block_index < count.number; block_index++) { // Snapshot of the objects.
+          job.objects.push_back(this->Read_Block(address.number + block_index).Pack_Fields());
+        }
+        this->Start_IO(job);
+        break;
+      }
+      case eCMD_IO_WAIT: {
+        cScript_Value status = this->Eval_Expression(command, 0);
+        if (this->Read_Block(status.number).value.number == eIO_PENDING) {
+          this->blocked = true;
+          this->pointer--; // Wait again on the next run.
+        }
+        break;
+      }
+      case eCMD_PUSH: {
+        cScript_Value result = this->Eval_Expression(command, 0);
+        if (!this->Check_Stack()) {
+          break;
+        }
+        this->stack.Push(result.number);
+        this->return_marks.push_back(false);
+        break;
+      }
+      case eCMD_POP: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cBlock& block = this->Write_Block(pointer.number);
+        block.value.Set_Number(this->stack.Pop());
+        this->return_marks.pop_back();
+        break;
+      }
+      case eCMD_REPEAT: {
+        cScript_Value lower = this->Eval_Expression(command, 0);
+        cScript_Value upper = this->Eval_Expression(command, 1);
+        cScript_Value pointer = this->Eval_Expression(command, 2);
+        cScript_Value jump_address = this->Eval_Expression(command, 3);
+        cBlock& var = this->Write_Block(pointer.number);
+        if ((var.value.number < lower.number) || (var.value.number > upper.number)) { // Reset variable if out of bounds.
+          var.value.Set_Number(lower.number++);
+          this->pointer = jump_address.number; // Jump to loop location.
+        }
         else {
           var.value.Set_Number(var.value.number++);
           if (var.value.number <= upper.number) {
@@ -912,13 +3188,16 @@ namespace Codeloader {
         break;
       }
       case eCMD_GET_OBJECT: {
-        cValue pointer = this->Eval_Expression(command, 0);
-        cValue object = this->Eval_Expression(command, 1);
-        cValue field = this->Eval_Expression(command, 2);
-        cBlock& source = (*this->memory)[object.number];
-        cBlock& dest = (*this->memory)[pointer.number];
-        dest.fields.Clear();
-        cArray<std::string> objects = Parse_Sausage_Text(source.fields[field.string].string, "|");
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value object = this->Eval_Expression(command, 1);
+        cScript_Value field = this->Eval_Expression(command, 2);
+        cBlock& source = this->Read_Block(object.number);
+        std::string field_name = field.Get_String();
+        cArray<std::string> objects;
+        if (source.fields.Does_Key_Exist(field_name)) { // A missing field reads as empty.
+          objects = Parse_Sausage_Text(source.fields[field_name].Get_String(), "|");
+        }
+        tObject fields;
         int obj_count = objects.Count();
         for (int obj_index = 0; obj_index < obj_count; obj_index++) {
           cArray<std::string> properties = Parse_Sausage_Text(objects[obj_index], ";");
@@ -928,42 +3207,46 @@ namespace Codeloader {
             if (pair.Count() == 2) {
               std::string name = pair[0];
               std::string value = pair[1];
-              dest.fields[name] = cValue();
-              try {
-                int number = Text_To_Number(value);
-                dest.fields[name].Set_Number(number);
-              }
-              catch (cError error) {
-                dest.fields[name].Set_String(value);
-              }
+              Parse_Value(value, fields[name], false);
             }
             else {
               this->Generate_Execution_Error("Sub object property is invalid.", command);
             }
           }
         }
+        if (this->Check_Fields(fields)) { // The destination is untouched on a fault.
+          this->Write_Block(pointer.number).fields = fields;
+        }
         break;
       }
       case eCMD_GET_LIST: {
-        cValue pointer = this->Eval_Expression(command, 0);
-        cValue object = this->Eval_Expression(command, 1);
-        cValue field = this->Eval_Expression(command, 2);
-        cBlock& source = (*this->memory)[object.number];
-        cBlock& dest = (*this->memory)[pointer.number];
-        cArray<std::string> items = Parse_Sausage_Text(source.fields[field.string].string, ",");
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cScript_Value object = this->Eval_Expression(command, 1);
+        cScript_Value field = this->Eval_Expression(command, 2);
+        cBlock& source = this->Read_Block(object.number);
+        std::string field_name = field.Get_String();
+        cArray<std::string> items;
+        if (source.fields.Does_Key_Exist(field_name)) { // A missing field reads as empty.
+          items = Parse_Sausage_Text(source.fields[field_name].Get_String(), ",");
+        }
         int item_count = items.Count();
         for (int item_index = 0; item_index < item_count; item_index++) {
-          cBlock& item = (*this->memory)[pointer.number + item_index];
-          try {
-            int number = Text_To_Number(items[item_index]);
-            item.value.Set_Number(number);
-          }
-          catch (cError error) {
-            item.value.Set_String(items[item_index]);
-          }
+          cBlock& item = this->Write_Block(pointer.number + item_index);
+          Parse_Value(items[item_index], item.value, false);
         }
         break;
       }
+      case eCMD_FRAME_STATS: {
+        cScript_Value pointer = this->Eval_Expression(command, 0);
+        cBlock& block = this->Write_Block(pointer.number);
+        block.fields["frames"].Set_Number(this->frame_stats.frames);
+        block.fields["fps"].Set_Number(this->frame_stats.fps);
+        block.fields["frame_time"].Set_Number(this->frame_stats.frame_time);
+        block.fields["script_time"].Set_Number(this->frame_stats.script_time);
+        block.fields["render_time"].Set_Number(this->frame_stats.render_time);
+        block.fields["budget"].Set_Number(this->frame_stats.budget);
+        break;
+      }
       default: {
         this->Generate_Execution_Error("Invalid command.", command);
       }
@@ -976,19 +3259,19 @@ namespace Codeloader {
    * @return The value from the operand.
    * @throws An error if something went wrong.
    */
-  cValue cSimulator::Eval_Operand(sOperand_Operator& operand) {
-    cValue value;
+  cScript_Value cSimulator::Eval_Operand(sOperand_Operator& operand) {
+    cScript_Value value;
     switch (operand.addr_mode) {
       case eADDR_VAL_NUMBER: {
         value.Set_Number(operand.value.number);
         break;
       }
       case eADDR_VAL_STRING: {
-        value.Set_String(operand.value.string);
+        value = operand.value; // Shares the interned literal.
         break;
       }
       case eADDR_IMMEDIATE: {
-        cBlock& block = (*this->memory)[operand.value.number];
+        cBlock& block = this->Read_Block(operand.value.number);
         // We need to determine if the value comes from an object or value.
         if (operand.field.length() > 0) {
           if (block.fields.Does_Key_Exist(operand.field)) {
@@ -1004,8 +3287,8 @@ namespace Codeloader {
         break;
       }
       case eADDR_POINTER: {
-        cBlock& pointer = (*this->memory)[operand.value.number];
-        cBlock& block = (*this->memory)[pointer.value.number];
+        cBlock& pointer = this->Read_Block(operand.value.number);
+        cBlock& block = this->Read_Block(pointer.value.number);
         // We need to determine if the value comes from an object or value.
         if (operand.field.length() > 0) {
           if (block.fields.Does_Key_Exist(operand.field)) {
@@ -1020,6 +3303,10 @@ namespace Codeloader {
         }
         break;
       }
+      case eADDR_FRAME: {
+        value = this->calls.slots[this->calls.Get_Slot(operand.value.number)];
+        break;
+      }
       default: {
         throw cError("Invalid address mode " + Number_To_Text(operand.addr_mode) + ".");
       }
@@ -1034,8 +3321,9 @@ namespace Codeloader {
    * @return The value from the expression evaluation.
    * @throws An error if something went wrong.
    */
-  cValue cSimulator::Eval_Expression(cBlock& command, int index) {
-    cValue value;
+  cScript_Value cSimulator::Eval_Expression(cBlock& command, int index) {
+    cScript_Value value;
+    bool building = false; // True while a cat chain is in the text buffer.
     if ((index < 0) || (index >= command.expressions.Count())) {
       this->Generate_Execution_Error("Expression does not exist at index " + Number_To_Text(index) + ".", command);
     }
@@ -1047,7 +3335,11 @@ namespace Codeloader {
       for (int oper_index = 1; oper_index < oper_count; oper_index += 2) {
         sOperand_Operator& oper = expression[oper_index];
         sOperand_Operator& operand = expression[oper_index + 1];
-        cValue operand_value = this->Eval_Operand(operand);
+        cScript_Value operand_value = this->Eval_Operand(operand);
+        if (building && (oper.oper_code != eOPER_CAT)) { // Flatten before other operators.
+          value.Set_String(this->text_buffer);
+          building = false;
+        }
         switch (oper.oper_code) {
           case eOPER_ADD: {
             value.Set_Number(value.number + operand_value.number);
@@ -1075,7 +3367,7 @@ namespace Codeloader {
             break;
           }
           case eOPER_RAND: {
-            value.Set_Number(this->io->Get_Random_Number(value.number, operand_value.number));
+            value.Set_Number(this->Get_Random(value.number, operand_value.number));
             break;
           }
           case eOPER_COS: {
@@ -1087,13 +3379,16 @@ namespace Codeloader {
             break;
           }
           case eOPER_CAT: {
-            if (value.type == eVALUE_NUMBER) {
-              value.Convert_To_String(); // Make sure we have a string.
+            if (!building) {
+              this->text_buffer.clear();
+              this->Append_Text(this->text_buffer, value);
+              building = true;
             }
-            if (value.type == eVALUE_NUMBER) {
-              operand_value.Convert_To_String();
+            this->Append_Text(this->text_buffer, operand_value);
+            if ((this->quota.string > 0) && ((int)this->text_buffer.size() > this->quota.string)) {
+              this->text_buffer.resize(this->quota.string);
+              this->Fault(eFAULT_STRING);
             }
-            value.Set_String(value.string + operand_value.string);
             break;
           }
           default: {
@@ -1101,6 +3396,9 @@ namespace Codeloader {
           }
         }
       }
+      if (building) {
+        value.Set_String(this->text_buffer);
+      }
     }
     else {
       this->Generate_Execution_Error("Empty expression.", command);
@@ -1108,6 +3406,291 @@ namespace Codeloader {
     return value;
   }
 
+  /**
+   * Appends a value to a text buffer. Numbers are formatted straight into
+   * the buffer.
+   * @param buffer The buffer to append to.
+   * @param value The value to append.
+   */
+  void cSimulator::Append_Text(std::string& buffer, cScript_Value& value) {
+    if (value.type == eVALUE_NUMBER) {
+      char digits[16];
+      std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value.number);
+      buffer.append(digits, result.ptr);
+    }
+    else {
+      buffer.append(value.Get_String());
+    }
+  }
+
+  /**
+   * Writes the addresses found by a spatial query to a list. The first
+   * item holds the number of addresses written.
+   * @param address The address of the list.
+   * @param limit The most addresses to write.
+   * @throws An error if the list is outside of memory.
+   */
+  void cSimulator::Write_Results(int address, int limit) {
+    int result_count = std::min((int)this->spatial_results.size(), std::max(limit, 0));
+    for (int result_index = 0; result_index < result_count; result_index++) {
+      this->Write_Block(address + 1 + result_index).value.Set_Number(this->spatial.address + this->spatial_results[result_index]);
+    }
+    this->Write_Block(address).value.Set_Number(result_count);
+  }
+
+  /**
+   * Accesses a block for reading. Workers see their own scratch area and
+   * may not read other elements of the list since those are being written.
+   * @param address The address of the block.
+   * @return A reference to the block.
+   * @throws An error if the address is invalid or being written by another worker.
+   */
+  cBlock& cSimulator::Read_Block(int address) {
+    if (this->worker) {
+      if ((address >= this->scratch_address) && (address < this->scratch_address + (int)this->scratch.size())) {
+        return this->scratch[address - this->scratch_address];
+      }
+      if ((address >= this->list_address) && (address < this->list_address + this->list_count) && (address != this->element)) {
+        throw cError("Parallel each cannot read other element at address " + Number_To_Text(address) + ".");
+      }
+    }
+    return (*this->memory)[address];
+  }
+
+  /**
+   * Accesses a block for writing. Workers may only write to their element
+   * and their scratch area. Element writes are stamped by the main
+   * simulator after the workers finish.
+   * @param address The address of the block.
+   * @return A reference to the block.
+   * @throws An error if the address is invalid or not writable.
+   */
+  cBlock& cSimulator::Write_Block(int address) {
+    if (this->worker) {
+      if ((address >= this->scratch_address) && (address < this->scratch_address + (int)this->scratch.size())) {
+        return this->scratch[address - this->scratch_address];
+      }
+      if (address != this->element) {
+        throw cError("Parallel each cannot write to address " + Number_To_Text(address) + ".");
+      }
+      return (*this->memory)[address];
+    }
+    return this->memory->Write(address);
+  }
+
+  /**
+   * Runs a subroutine once for each element of a list on worker threads.
+   * The list is split into one run of elements per worker. Each worker
+   * has a private copy of the scratch area, which starts cleared and has
+   * the element address in its first item. Afterwards the number items of
+   * the scratch copies are added into the scratch area in worker order.
+   * @param address The address of the list.
+   * @param count The number of elements.
+   * @param routine The address of the subroutine.
+   * @param scratch_address The address of the scratch area.
+   * @param scratch_size The number of items in the scratch area.
+   * @throws An error if a worker failed.
+   */
+  void cSimulator::Parallel_Each(int address, int count, int routine, int scratch_address, int scratch_size) {
+    if ((count <= 0) || (scratch_size <= 0)) {
+      return;
+    }
+    (*this->memory)[address]; // Check both ends of the list and scratch area.
+    (*this->memory)[address + count - 1];
+    (*this->memory)[scratch_address];
+    (*this->memory)[scratch_address + scratch_size - 1];
+    if (!this->pool) {
+      int thread_count = std::max((int)std::thread::hardware_concurrency(), 1);
+      this->pool = new cThread_Pool(thread_count);
+      for (int worker_index = 0; worker_index < thread_count; worker_index++) {
+        cSimulator* worker = new cSimulator(this->memory, this->io, 0);
+        worker->worker = true;
+        this->workers.push_back(worker);
+      }
+    }
+    int worker_count = std::min((int)this->workers.size(), count);
+    for (int worker_index = 0; worker_index < worker_count; worker_index++) {
+      cSimulator* worker = this->workers[worker_index];
+      worker->list_address = address;
+      worker->list_count = count;
+      worker->scratch_address = scratch_address;
+      worker->scratch.assign(scratch_size, cBlock());
+    }
+    this->pool->For_Each(worker_count, [&](int worker_index) {
+      cSimulator* worker = this->workers[worker_index];
+      int first = (int)(((long long)count * worker_index) / worker_count);
+      int last = (int)(((long long)count * (worker_index + 1)) / worker_count);
+      for (int element_index = first; element_index < last; element_index++) {
+        worker->element = address + element_index;
+        worker->scratch[0].value.Set_Number(worker->element);
+        worker->Run_Element(routine);
+      }
+    });
+    for (int element_index = 0; element_index < count; element_index++) { // Stamp the elements for saves.
+      this->memory->Write(address + element_index);
+    }
+    for (int item_index = 1; item_index < scratch_size; item_index++) {
+      cBlock& item = this->memory->Write(scratch_address + item_index);
+      int total = item.value.number;
+      for (int worker_index = 0; worker_index < worker_count; worker_index++) {
+        total += this->workers[worker_index]->scratch[item_index].value.number;
+      }
+      item.value.Set_Number(total);
+    }
+  }
+
+  /**
+   * Runs a subroutine on a worker until it returns. Only commands that
+   * work on memory are allowed.
+   * @param routine The address of the subroutine.
+   * @throws An error if the subroutine used a command that is not allowed
+   * or ran for too long.
+   */
+  void cSimulator::Run_Element(int routine) {
+    this->stack = cArray<int>();
+    this->stack.Push(PARALLEL_RETURN);
+    this->return_marks.assign(1, false);
+    this->calls.Reset();
+    this->pointer = routine;
+    int steps = 0;
+    while (this->pointer != PARALLEL_RETURN) {
+      cBlock& command = (*this->memory)[this->pointer++];
+      switch (command.code) {
+        case eCMD_NONE:
+        case eCMD_STORE:
+        case eCMD_SET:
+        case eCMD_TEST:
+        case eCMD_CALL:
+        case eCMD_RETURN:
+        case eCMD_PUSH:
+        case eCMD_POP:
+        case eCMD_REPEAT:
+        case eCMD_GET_OBJECT:
+        case eCMD_GET_LIST:
+        case eCMD_CALL_NATIVE:
+        case eCMD_INVOKE:
+        case eCMD_TAIL_INVOKE:
+        case eCMD_ENTER:
+        case eCMD_LEAVE:
+        case eCMD_STORE_LOCAL: {
+          this->Command_Processor(command);
+          break;
+        }
+        default: {
+          this->Generate_Execution_Error("Command is not allowed in parallel each.", command);
+        }
+      }
+      if (++steps > PARALLEL_STEP_LIMIT) {
+        this->Generate_Execution_Error("Parallel each element ran too long.", command);
+      }
+    }
+  }
+
+  /**
+   * Gets a channel by name. Channels found in the hub are remembered so
+   * later sends and receives do not take the hub lock.
+   * @param name The name of the channel.
+   * @return The channel.
+   * @throws An error if the channel was not opened.
+   */
+  cChannel* cSimulator::Get_Channel(std::string name) {
+    std::unordered_map<std::string, cChannel*>::iterator entry = this->channels.find(name);
+    if (entry != this->channels.end()) {
+      return entry->second;
+    }
+    cChannel* channel = channel_hub.Find(name);
+    if (!channel) {
+      throw cError("Channel " + name + " is not open.");
+    }
+    this->channels[name] = channel;
+    return channel;
+  }
+
+  /**
+   * Sends a message on a channel. Whether it went through depends on the
+   * other instances, so it is recorded, and replayed without the channel.
+   * @param name The name of the channel.
+   * @param value The message.
+   * @return True if the message was sent, false if the channel is full.
+   * @throws An error if the channel is not open.
+   */
+  bool cSimulator::Send_Message(std::string name, const cScript_Value& value) {
+    if (this->recorder && (this->recorder->mode == eRECORD_REPLAY)) {
+      cScript_Value message;
+      return this->recorder->Replay_Message(message);
+    }
+    bool sent = this->Get_Channel(name)->Send(value, this);
+    if (this->recorder) {
+      this->recorder->Record_Message(sent, value);
+    }
+    return sent;
+  }
+
+  /**
+   * Receives a message from a channel. The message is recorded, and
+   * replayed from the log.
+   * @param name The name of the channel.
+   * @param value Receives the message.
+   * @return True if a message was received, false if the channel is empty.
+   * @throws An error if the channel is not open.
+   */
+  bool cSimulator::Receive_Message(std::string name, cScript_Value& value) {
+    if (this->recorder && (this->recorder->mode == eRECORD_REPLAY)) {
+      return this->recorder->Replay_Message(value);
+    }
+    bool received = this->Get_Channel(name)->Receive(value);
+    if (this->recorder) {
+      this->recorder->Record_Message(received, value);
+    }
+    return received;
+  }
+
+  /**
+   * Draws the visible part of a tile map. The map is a list of tile numbers
+   * stored row by row, where tile 0 is empty. Tile n is drawn with the
+   * image named by the tileset followed by n.
+   * @param address The address of the map.
+   * @param columns The number of columns in the map.
+   * @param rows The number of rows in the map.
+   * @param tile_size The width and height of a tile in pixels.
+   * @param tileset The name of the tileset.
+   * @param camera_x The x coordinate of the map at the left of the screen.
+   * @param camera_y The y coordinate of the map at the top of the screen.
+   * @throws An error if the map is outside of memory.
+   */
+  void cSimulator::Draw_Map(int address, int columns, int rows, int tile_size, std::string tileset, int camera_x, int camera_y) {
+    if ((columns > 0) && (rows > 0) && (tile_size > 0)) {
+      (*this->memory)[address]; // Check both ends of the map.
+      (*this->memory)[address + (columns * rows) - 1];
+      if (tileset != this->tileset) { // Names are built once per tile of a tileset.
+        this->tileset = tileset;
+        this->tile_names.clear();
+      }
+      int view_width = (this->view_width > 0) ? this->view_width : columns * tile_size;
+      int view_height = (this->view_height > 0) ? this->view_height : rows * tile_size;
+      int first_column = std::max(0, (int)std::floor((double)camera_x / tile_size));
+      int last_column = std::min(columns - 1, (int)std::floor((double)(camera_x + view_width - 1) / tile_size));
+      int first_row = std::max(0, (int)std::floor((double)camera_y / tile_size));
+      int last_row = std::min(rows - 1, (int)std::floor((double)(camera_y + view_height - 1) / tile_size));
+      cBlock* map = this->memory->memory + address;
+      for (int row = first_row; row <= last_row; row++) {
+        cBlock* line = map + (row * columns);
+        int y = (row * tile_size) - camera_y;
+        for (int column = first_column; column <= last_column; column++) {
+          int tile = line[column].value.number;
+          if (tile > 0) {
+            std::unordered_map<int, std::string>::iterator name = this->tile_names.find(tile);
+            if (name == this->tile_names.end()) {
+              name = this->tile_names.emplace(tile, tileset + Number_To_Text(tile)).first;
+            }
+            this->io->Draw_Image(name->second, (column * tile_size) - camera_x, y, tile_size, tile_size, 0, false, false);
+            this->metrics.frame_draws++;
+          }
+        }
+      }
+    }
+  }
+
   /**
    * Evaluates a condition.
    * @param command The associated command.
@@ -1117,15 +3700,15 @@ namespace Codeloader {
    */
   bool cSimulator::Eval_Condition(cBlock& command, sCondition_Logic& condition) {
     bool result = false;
-    cValue left_val = this->Eval_Expression(command, condition.left_exp);
-    cValue right_val = this->Eval_Expression(command, condition.right_exp);
+    cScript_Value left_val = this->Eval_Expression(command, condition.left_exp);
+    cScript_Value right_val = this->Eval_Expression(command, condition.right_exp);
     switch (condition.test) {
       case eTEST_EQUALS: {
         if (left_val.type == eVALUE_NUMBER) {
           result = (left_val.number == right_val.number);
         }
         else if (left_val.type == eVALUE_STRING) {
-          result = (left_val.string == right_val.string);
+          result = left_val.Equals(right_val);
         }
         break;
       }
@@ -1134,7 +3717,7 @@ namespace Codeloader {
           result = (left_val.number != right_val.number);
         }
         else if (left_val.type == eVALUE_STRING) {
-          result = (left_val.string != right_val.string);
+          result = !left_val.Equals(right_val);
         }
         break;
       }
@@ -1216,39 +3799,28 @@ namespace Codeloader {
    * @throws An error if the file could not be loaded.
    */
   int cSimulator::Load(std::string name, cMemory* memory, int address) {
-    std::ifstream file(name);
-    int count = 0;
-    if (file) {
-      while (!file.eof()) {
-        std::string line;
-        std::getline(file, line);
-        if (file.good()) {
-          if (line == "object") {
-            (*memory)[address].Clear();
-          }
-          else if (line == "end") {
-            address++; // Go to next object.
-            count++;
-          }
-          else {
-            cArray<std::string> pair = Parse_Sausage_Text(line, "=");
-            std::string name = pair[0];
-            std::string value = pair[1];
-            (*memory)[address].fields[name] = cValue();
-            try {
-              int number = Text_To_Number(value);
-              (*memory)[address].fields[name].Set_Number(number);
-            }
-            catch (cError error) { // A string.
-              (*memory)[address].fields[name].Set_String(value);
-            }
-          }
-        }
-      }
+    std::vector<tObject> objects;
+    this->Wait_For_Saves(name);
+    if (!this->Charge_Read(name)) {
+      return 0;
     }
-    else {
+    auto start = std::chrono::steady_clock::now();
+    if (!Read_Objects(name, objects)) {
       throw cError("Could not load file " + name + ".");
     }
+    this->metrics.loads++;
+    this->metrics.load_time.Observe(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    int count = objects.size();
+    for (int object_index = 0; object_index < count; object_index++) {
+      if (!this->Check_Fields(objects[object_index])) {
+        return 0;
+      }
+    }
+    for (int object_index = 0; object_index < count; object_index++) {
+      cBlock& block = memory->Write(address + object_index);
+      block.Clear();
+      block.Unpack_Fields(objects[object_index]);
+    }
     return count;
   }
 
@@ -1261,27 +3833,2747 @@ namespace Codeloader {
    * @throws An error if the file could not be saved.
    */
   void cSimulator::Save(std::string name, cMemory* memory, int address, int count) {
-    std::ofstream file(name);
-    if (file) {
+    this->Wait_For_Saves(name); // An older snapshot must not land on top of this one.
+    if (this->saves.Does_Key_Exist(name)) { // A full save starts a new journal.
+      this->saves[name].count = -1;
+    }
+    if (!this->Check_Write()) {
+      return;
+    }
+    std::vector<tObject> objects;
+    for (int block_index = 0; block_index < count; block_index++) {
+      objects.push_back((*memory)[address + block_index].Pack_Fields());
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (!Write_Objects(name, objects)) {
+      throw cError("Could not save file " + name + ".");
+    }
+    this->usage.written += Get_File_Size(name);
+    this->metrics.saves++;
+    this->metrics.save_time.Observe(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  /**
+   * Saves only the objects written since the last save of the file. The
+   * first save of a range writes the whole file. After that the changed
+   * objects are appended to a journal next to the file, which is folded
+   * back into the file once it holds as many patches as the range.
+   * @param name The name of the file.
+   * @param address The address where the list starts.
+   * @param count The number of objects to save.
+   * @throws An error if the file could not be saved.
+   */
+  void cSimulator::Save_Changes(std::string name, int address, int count) {
+    if (!this->saves.Does_Key_Exist(name)) {
+      sSave_State fresh = { 0, -1, 0, 0 };
+      this->saves[name] = fresh;
+    }
+    sSave_State& state = this->saves[name];
+    bool full = (state.count != count) || (state.address != address) || (state.entries >= std::max(count, JOURNAL_MINIMUM));
+    if (full) {
+      this->Save(name, this->memory, address, count);
+      state.address = address;
+      state.count = count;
+      state.entries = 0;
+    }
+    else {
+      if (!this->Check_Write()) {
+        return;
+      }
+      this->Wait_For_Saves(name); // The pending save would remove the journal.
+      auto start = std::chrono::steady_clock::now();
+      long long size = Get_File_Size(name + ".journal");
+      std::ofstream journal(name + ".journal", std::ios::app);
       for (int block_index = 0; block_index < count; block_index++) {
-        cBlock& block = (*memory)[address + block_index];
-        file << "object" << std::endl;
-        int key_count = block.fields.Count();
-        for (int key_index = 0; key_index < key_count; key_index++) {
-          file << block.fields.keys[key_index] << "=";
-          if (block.fields.values[key_index].type == eVALUE_NUMBER) {
-            file << block.fields.values[key_index].number << std::endl;
-          }
-          else if (block.fields.values[key_index].type == eVALUE_STRING) {
-            file << block.fields.values[key_index].string << std::endl;
-          }
+        if (this->memory->stamps[address + block_index] > state.stamp) {
+          journal << "patch " << block_index << "\n";
+          tObject object = (*this->memory)[address + block_index].Pack_Fields();
+          Write_Object(journal, object);
+          state.entries++;
         }
-        file << "end" << std::endl;
+      }
+      journal.close();
+      if (!journal) {
+        throw cError("Could not save file " + name + ".");
+      }
+      this->usage.written += Get_File_Size(name + ".journal") - size;
+      this->metrics.saves++;
+      this->metrics.save_time.Observe(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+    state.stamp = this->memory->clock;
+  }
+
+  /**
+   * Starts an asynchronous load or save. While recording or replaying the
+   * job is finished right away so the session stays reproducible.
+   * @param job The job to start.
+   */
+  void cSimulator::Start_IO(sIO_Job& job) {
+    bool allowed = (job.type == eIO_LOAD) ? this->Charge_Read(job.name) : this->Check_Write();
+    if (!allowed) {
+      this->memory->Write(job.status).value.Set_Number(eIO_FAILED);
+      return;
+    }
+    this->memory->Write(job.status).value.Set_Number(eIO_PENDING);
+    if (job.type == eIO_SAVE) {
+      this->pending_saves[job.name]++;
+    }
+    if (this->recorder) {
+      cIO_Worker::Run_Job(job);
+      this->Finish_IO(job);
+    }
+    else {
+      if (!this->io_worker) {
+        this->io_worker = new cIO_Worker();
+      }
+      this->io_worker->Add(job);
+    }
+  }
+
+  /**
+   * Commits finished asynchronous loads and saves. Called between
+   * instructions so a load lands in memory all at once.
+   */
+  void cSimulator::Commit_IO() {
+    if (this->io_worker && (this->io_worker->completed.load(std::memory_order_relaxed) > 0)) {
+      sIO_Job job;
+      while (this->io_worker->Take(job)) {
+        this->Finish_IO(job);
+      }
+    }
+  }
+
+  /**
+   * Waits until the queued saves of a file have finished. Saves of one
+   * file then land in the order they were made, and only the newest
+   * snapshot removes the journal.
+   * @param name The name of the file.
+   */
+  void cSimulator::Wait_For_Saves(std::string name) {
+    while (this->pending_saves.find(name) != this->pending_saves.end()) {
+      this->Commit_IO();
+      if (this->pending_saves.find(name) != this->pending_saves.end()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+  }
+
+  /**
+   * Writes the result of a finished job to memory.
+   * @param job The finished job.
+   */
+  void cSimulator::Finish_IO(sIO_Job& job) {
+    if ((job.type == eIO_SAVE) && (--this->pending_saves[job.name] == 0)) {
+      this->pending_saves.erase(job.name);
+    }
+    if (job.type == eIO_LOAD) {
+      this->metrics.loads++;
+      this->metrics.load_time.Observe(job.elapsed);
+      int object_count = job.objects.size();
+      for (int object_index = 0; job.success && (object_index < object_count); object_index++) {
+        job.success = this->Check_Fields(job.objects[object_index]);
       }
     }
     else {
-      throw cError("Could not save file " + name + ".");
+      this->metrics.saves++;
+      this->metrics.save_time.Observe(job.elapsed);
+      this->usage.written += Get_File_Size(job.name);
+    }
+    if (job.success && (job.type == eIO_LOAD)) {
+      int count = job.objects.size();
+      for (int object_index = 0; object_index < count; object_index++) {
+        cBlock& block = this->memory->Write(job.address + object_index);
+        block.Clear();
+        block.Unpack_Fields(job.objects[object_index]);
+      }
+      this->memory->Write(job.address).value.Set_Number(count);
+    }
+    this->memory->Write(job.status).value.Set_Number(job.success ? eIO_DONE : eIO_FAILED);
+  }
+
+  // **************************************************************************
+  // Metrics Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a histogram.
+   * @param bounds The upper bounds of the buckets in increasing order.
+   */
+  cHistogram::cHistogram(std::vector<long long> bounds) {
+    this->bounds = bounds;
+    this->counts.assign(bounds.size() + 1, 0);
+    this->sum = 0;
+    this->count = 0;
+  }
+
+  /**
+   * Adds a value to the histogram.
+   * @param value The value.
+   */
+  void cHistogram::Observe(long long value) {
+    int bucket = std::lower_bound(this->bounds.begin(), this->bounds.end(), value) - this->bounds.begin();
+    this->counts[bucket]++;
+    this->sum += value;
+    this->count++;
+  }
+
+  /**
+   * Writes the histogram with cumulative buckets.
+   * @param file The stream to write to.
+   * @param name The name of the metric.
+   * @param help The description of the metric.
+   */
+  void cHistogram::Write(std::ostream& file, std::string name, std::string help) {
+    file << "# HELP " << name << " " << help << "\n";
+    file << "# TYPE " << name << " histogram\n";
+    long long total = 0;
+    int bound_count = this->bounds.size();
+    for (int bound_index = 0; bound_index < bound_count; bound_index++) {
+      total += this->counts[bound_index];
+      file << name << "_bucket{le=\"" << this->bounds[bound_index] << "\"} " << total << "\n";
+    }
+    file << name << "_bucket{le=\"+Inf\"} " << this->count << "\n";
+    file << name << "_sum " << this->sum << "\n";
+    file << name << "_count " << this->count << "\n";
+  }
+
+  /**
+   * Creates the metrics with exporting turned off.
+   */
+  cMetrics::cMetrics() :
+    slice_instructions({ 10, 100, 1000, 10000, 100000, 1000000 }),
+    frame_time({ 4000, 8000, 16667, 33333, 50000, 100000, 250000 }),
+    load_time({ 100, 1000, 10000, 100000, 1000000 }),
+    save_time({ 100, 1000, 10000, 100000, 1000000 }),
+    refresh_draws({ 10, 50, 100, 250, 500, 1000, 2500 }) {
+    this->period = 0;
+    this->last_export = 0;
+    this->instructions = 0;
+    this->slices = 0;
+    this->overruns = 0;
+    this->refreshes = 0;
+    this->draws = 0;
+    this->frame_draws = 0;
+    this->loads = 0;
+    this->saves = 0;
+    this->last_refresh = std::chrono::steady_clock::now();
+  }
+
+  /**
+   * Ends a frame. Records the frame time and the draws since the last
+   * refresh.
+   */
+  void cMetrics::Refresh() {
+    auto now = std::chrono::steady_clock::now();
+    if (this->refreshes > 0) {
+      this->frame_time.Observe(std::chrono::duration_cast<std::chrono::microseconds>(now - this->last_refresh).count());
+    }
+    this->last_refresh = now;
+    this->refreshes++;
+    this->draws += this->frame_draws;
+    this->refresh_draws.Observe(this->frame_draws);
+    this->frame_draws = 0;
+  }
+
+  /**
+   * Writes the counters and histograms.
+   * @param file The stream to write to.
+   */
+  void cMetrics::Write(std::ostream& file) {
+    Write_Metric(file, "clsh_instructions_total", "counter", "Instructions run.", this->instructions);
+    Write_Metric(file, "clsh_slices_total", "counter", "Run slices.", this->slices);
+    Write_Metric(file, "clsh_slice_overruns_total", "counter", "Slices that ran past their time.", this->overruns);
+    Write_Metric(file, "clsh_refreshes_total", "counter", "Screen refreshes.", this->refreshes);
+    Write_Metric(file, "clsh_draws_total", "counter", "Text and image draws.", this->draws);
+    Write_Metric(file, "clsh_loads_total", "counter", "File loads.", this->loads);
+    Write_Metric(file, "clsh_saves_total", "counter", "File saves.", this->saves);
+    this->slice_instructions.Write(file, "clsh_slice_instructions", "Instructions run per slice.");
+    this->frame_time.Write(file, "clsh_frame_time_microseconds", "Time between refreshes.");
+    this->load_time.Write(file, "clsh_load_time_microseconds", "Time to read a file.");
+    this->save_time.Write(file, "clsh_save_time_microseconds", "Time to write a file.");
+    this->refresh_draws.Write(file, "clsh_refresh_draws", "Draws per refresh.");
+  }
+
+  /**
+   * Writes a single counter or gauge.
+   * @param file The stream to write to.
+   * @param name The name of the metric.
+   * @param type Either counter or gauge.
+   * @param help The description of the metric.
+   * @param value The value.
+   */
+  void Write_Metric(std::ostream& file, std::string name, std::string type, std::string help, long long value) {
+    file << "# HELP " << name << " " << help << "\n";
+    file << "# TYPE " << name << " " << type << "\n";
+    file << name << " " << value << "\n";
+  }
+
+  // **************************************************************************
+  // Timer Wheel Implementation
+  // **************************************************************************
+
+  /**
+   * Creates an empty timer wheel. Each level has 64 slots, and each slot
+   * of a level covers all 64 slots of the level below it.
+   * @param wheel The kind of wheel, which is kept in the timer handles.
+   */
+  cTimer_Wheel::cTimer_Wheel(int wheel) {
+    this->wheel = wheel;
+    this->current = 0;
+    this->active = 0;
+    this->free = -1;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+      for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+        this->slots[level][slot] = -1;
+      }
+    }
+  }
+
+  /**
+   * Schedules a timer.
+   * @param address The address to call when the timer is due.
+   * @param due The tick the timer is due on.
+   * @return The handle of the timer.
+   * @throws An error if there are too many timers.
+   */
+  int cTimer_Wheel::Schedule(int address, long long due) {
+    int index = this->free;
+    if (index >= 0) {
+      this->free = this->timers[index].next;
+    }
+    else {
+      if ((int)this->timers.size() == TIMER_LIMIT) {
+        throw cError("Too many timers.");
+      }
+      index = this->timers.size();
+      sTimer timer = { 0, 0, -1, -1, 0, 0, 0, false };
+      this->timers.push_back(timer);
+    }
+    sTimer& timer = this->timers[index];
+    timer.address = address;
+    timer.due = std::max(due, this->current + 1); // Late timers fire on the next tick.
+    timer.active = true;
+    this->Insert(index);
+    this->active++;
+    return (timer.generation << 21) | (this->wheel << 20) | index;
+  }
+
+  /**
+   * Cancels a timer. Handles of timers that fired or were cancelled are
+   * ignored.
+   * @param handle The handle of the timer.
+   * @return True if the timer was cancelled, false otherwise.
+   */
+  bool cTimer_Wheel::Cancel(int handle) {
+    int index = handle & (TIMER_LIMIT - 1);
+    if ((handle >= 0) && (index < (int)this->timers.size())) {
+      sTimer& timer = this->timers[index];
+      if (timer.active && (timer.generation == (handle >> 21))) {
+        this->Unlink(index);
+        this->Release(index);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Moves the wheel forward and collects the due timers. When a level
+   * comes around, the slot above it is spread into the lower levels.
+   * @param now The tick to move to.
+   * @param due Receives the addresses of the due timers in order.
+   */
+  void cTimer_Wheel::Advance(long long now, std::vector<int>& due) {
+    if (this->active == 0) { // Nothing to fire so jump ahead.
+      this->current = std::max(this->current, now);
+      return;
+    }
+    while ((this->current < now) && (this->active > 0)) {
+      this->current++;
+      for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if ((this->current & ((1LL << (WHEEL_BITS * level)) - 1)) != 0) {
+          break;
+        }
+        int slot = (this->current >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+        int index = this->slots[level][slot];
+        this->slots[level][slot] = -1;
+        while (index >= 0) {
+          int next = this->timers[index].next;
+          this->Insert(index);
+          index = next;
+        }
+      }
+      int slot = this->current & (WHEEL_SLOTS - 1);
+      int index = this->slots[0][slot];
+      this->slots[0][slot] = -1;
+      while (index >= 0) {
+        int next = this->timers[index].next;
+        due.push_back(this->timers[index].address);
+        this->Release(index);
+        index = next;
+      }
+    }
+    this->current = std::max(this->current, now);
+  }
+
+  /**
+   * Puts a timer into the slot for its due tick.
+   * @param index The index of the timer.
+   */
+  void cTimer_Wheel::Insert(int index) {
+    sTimer& timer = this->timers[index];
+    long long delta = timer.due - this->current;
+    int level = 0;
+    while ((level < WHEEL_LEVELS - 1) && (delta >= (1LL << (WHEEL_BITS * (level + 1))))) {
+      level++;
+    }
+    int slot = (timer.due >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    timer.level = level;
+    timer.slot = slot;
+    timer.prev = -1;
+    timer.next = this->slots[level][slot];
+    if (timer.next >= 0) {
+      this->timers[timer.next].prev = index;
+    }
+    this->slots[level][slot] = index;
+  }
+
+  /**
+   * Takes a timer out of its slot.
+   * @param index The index of the timer.
+   */
+  void cTimer_Wheel::Unlink(int index) {
+    sTimer& timer = this->timers[index];
+    if (timer.prev >= 0) {
+      this->timers[timer.prev].next = timer.next;
+    }
+    else {
+      this->slots[timer.level][timer.slot] = timer.next;
+    }
+    if (timer.next >= 0) {
+      this->timers[timer.next].prev = timer.prev;
+    }
+  }
+
+  /**
+   * Returns a timer to the free list and retires its handle.
+   * @param index The index of the timer.
+   */
+  void cTimer_Wheel::Release(int index) {
+    sTimer& timer = this->timers[index];
+    timer.active = false;
+    timer.generation = (timer.generation + 1) & 0x3FF;
+    timer.next = this->free;
+    this->free = index;
+    this->active--;
+  }
+
+  // **************************************************************************
+  // Call Stack Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a call stack. All slots and frames are allocated up front so
+   * invoke never allocates. The root frame holds the locals of the main
+   * program.
+   * @param slot_count The number of slots shared by all frames.
+   * @param frame_count The largest number of frames.
+   */
+  cCall_Stack::cCall_Stack(int slot_count, int frame_count) :
+    slots(slot_count),
+    frames(frame_count) {
+    this->Reset();
+  }
+
+  /**
+   * Drops all frames but the root frame, which is emptied.
+   */
+  void cCall_Stack::Reset() {
+    this->frames[0] = { 0, 0, -1, -1 };
+    this->count = 1;
+  }
+
+  /**
+   * Gets the current frame.
+   * @return The current frame.
+   */
+  sFrame& cCall_Stack::Top() {
+    return this->frames[this->count - 1];
+  }
+
+  /**
+   * Gets the first slot above the current frame.
+   * @return The slot index.
+   */
+  int cCall_Stack::Get_Top() {
+    sFrame& frame = this->Top();
+    return (frame.base + frame.size);
+  }
+
+  /**
+   * Gets the index of a slot of the current frame.
+   * @param slot The slot number within the frame.
+   * @return The index into the slots.
+   * @throws An error if the frame does not have the slot.
+   */
+  int cCall_Stack::Get_Slot(int slot) {
+    sFrame& frame = this->Top();
+    if ((slot < 0) || (slot >= frame.size)) {
+      throw cError("Frame slot " + Number_To_Text(slot) + " is out of range.");
+    }
+    return (frame.base + slot);
+  }
+
+  /**
+   * Pushes a frame whose arguments are already in the slots above the
+   * current frame.
+   * @param size The number of arguments.
+   * @param return_address The address to return to.
+   * @param result The slot index the result goes to or -1.
+   * @return True if the frame was pushed, false on overflow.
+   */
+  bool cCall_Stack::Push(int size, int return_address, int result) {
+    int base = this->Get_Top();
+    if ((this->count == (int)this->frames.size()) || (base + size > (int)this->slots.size())) {
+      return false;
+    }
+    this->frames[this->count++] = { base, size, return_address, result };
+    return true;
+  }
+
+  /**
+   * Sets the number of slots of the current frame. New slots are zero.
+   * @param size The number of slots.
+   * @return True if the slots fit, false on overflow.
+   */
+  bool cCall_Stack::Resize(int size) {
+    sFrame& frame = this->Top();
+    if ((size < 0) || (frame.base + size > (int)this->slots.size())) {
+      return false;
+    }
+    for (int slot_index = frame.size; slot_index < size; slot_index++) {
+      this->slots[frame.base + slot_index].Set_Number(0);
+    }
+    frame.size = size;
+    return true;
+  }
+
+  /**
+   * Replaces the current frame with the arguments above it. The return
+   * address and result slot are kept so the callee returns to our caller.
+   * @param size The number of arguments.
+   */
+  void cCall_Stack::Tail(int size) {
+    sFrame& frame = this->Top();
+    int from = frame.base + frame.size;
+    for (int slot_index = 0; slot_index < size; slot_index++) {
+      this->slots[frame.base + slot_index] = this->slots[from + slot_index];
+    }
+    frame.size = size;
+  }
+
+  /**
+   * Pops the current frame.
+   * @return The popped frame.
+   */
+  sFrame cCall_Stack::Pop() {
+    return this->frames[--this->count];
+  }
+
+  // **************************************************************************
+  // Channel Implementation
+  // **************************************************************************
+
+  cChannel_Hub channel_hub;
+
+  /**
+   * Creates a channel. The number of slots is rounded up to a power of two.
+   * @param name The name of the channel.
+   * @param type Either eCHANNEL_SINGLE or eCHANNEL_MULTI.
+   * @param element The type of message, eELEMENT_ANY, eELEMENT_NUMBER or
+   * eELEMENT_STRING.
+   * @param capacity The least number of messages the channel holds.
+   * @throws An error if the capacity is invalid.
+   */
+  cChannel::cChannel(std::string name, int type, int element, int capacity) {
+    if ((capacity < 1) || (capacity > CHANNEL_LIMIT)) {
+      throw cError("Invalid channel size " + Number_To_Text(capacity) + ".");
+    }
+    this->name = name;
+    this->type = type;
+    this->element = element;
+    this->capacity = 1;
+    while (this->capacity < (std::size_t)capacity) {
+      this->capacity <<= 1;
+    }
+    this->mask = this->capacity - 1;
+    this->slots = new sChannel_Slot[this->capacity];
+    for (std::size_t slot_index = 0; slot_index < this->capacity; slot_index++) {
+      this->slots[slot_index].sequence.store(slot_index, std::memory_order_relaxed);
+    }
+    this->head.store(0, std::memory_order_relaxed);
+    this->tail.store(0, std::memory_order_relaxed);
+    this->producer.store(NULL, std::memory_order_relaxed);
+  }
+
+  /**
+   * Frees the slots.
+   */
+  cChannel::~cChannel() {
+    delete[] this->slots;
+  }
+
+  /**
+   * Puts a message into the channel without waiting. A single producer
+   * channel only moves the tail. A multiple producer channel claims a slot
+   * by moving the tail with compare and swap and publishes it through the
+   * sequence of the slot.
+   * @param value The message.
+   * @param sender The simulator sending the message. The first sender owns
+   * a single producer channel.
+   * @return True if the message was sent, false if the channel is full.
+   * @throws An error if the message has the wrong type or another
+   * simulator sends on a single producer channel.
+   */
+  bool cChannel::Send(const cScript_Value& value, cSimulator* sender) {
+    if ((this->element == eELEMENT_NUMBER) && (value.type != eVALUE_NUMBER)) {
+      throw cError("Channel " + this->name + " only carries numbers.");
+    }
+    if ((this->element == eELEMENT_STRING) && (value.type != eVALUE_STRING)) {
+      throw cError("Channel " + this->name + " only carries strings.");
+    }
+    if (this->type == eCHANNEL_SINGLE) {
+      cSimulator* owner = NULL;
+      if (!this->producer.compare_exchange_strong(owner, sender, std::memory_order_relaxed) && (owner != sender)) {
+        throw cError("Channel " + this->name + " has one producer already.");
+      }
+      std::size_t tail = this->tail.load(std::memory_order_relaxed);
+      if (tail - this->head.load(std::memory_order_acquire) == this->capacity) {
+        return false;
+      }
+      this->slots[tail & this->mask].value = value;
+      this->tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+    std::size_t position = this->tail.load(std::memory_order_relaxed);
+    sChannel_Slot* slot = NULL;
+    while (true) {
+      slot = &this->slots[position & this->mask];
+      std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      long long difference = (long long)sequence - (long long)position;
+      if (difference == 0) {
+        if (this->tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (difference < 0) { // Full.
+        return false;
+      }
+      else {
+        position = this->tail.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = value;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Takes a message from the channel without waiting. Only one instance
+   * may receive from a channel.
+   * @param value Receives the message.
+   * @return True if a message was received, false if the channel is empty.
+   */
+  bool cChannel::Receive(cScript_Value& value) {
+    std::size_t head = this->head.load(std::memory_order_relaxed);
+    sChannel_Slot& slot = this->slots[head & this->mask];
+    if (this->type == eCHANNEL_SINGLE) {
+      if (head == this->tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+      value = slot.value;
+      slot.value.Set_Number(0); // Let go of the string.
+      this->head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+      return false;
     }
+    value = slot.value;
+    slot.value.Set_Number(0);
+    slot.sequence.store(head + this->capacity, std::memory_order_release);
+    this->head.store(head + 1, std::memory_order_relaxed);
+    return true;
   }
 
-}
\ No newline at end of file
+  /**
+   * Frees the channels.
+   */
+  cChannel_Hub::~cChannel_Hub() {
+    for (std::pair<const std::string, cChannel*>& entry : this->channels) {
+      delete entry.second;
+    }
+  }
+
+  /**
+   * Opens a channel. Opening a channel that exists returns it.
+   * @param name The name of the channel.
+   * @param type Either eCHANNEL_SINGLE or eCHANNEL_MULTI.
+   * @param element The type of message the channel carries.
+   * @param capacity The least number of messages the channel holds.
+   * @return The channel.
+   * @throws An error if the channel exists with another type.
+   */
+  cChannel* cChannel_Hub::Open(std::string name, int type, int element, int capacity) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    cChannel*& channel = this->channels[name];
+    if (!channel) {
+      channel = new cChannel(name, type, element, capacity);
+    }
+    else if ((channel->type != type) || (channel->element != element)) {
+      throw cError("Channel " + name + " is already open with another type.");
+    }
+    return channel;
+  }
+
+  /**
+   * Finds a channel.
+   * @param name The name of the channel.
+   * @return The channel or NULL if it is not open.
+   */
+  cChannel* cChannel_Hub::Find(std::string name) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    std::unordered_map<std::string, cChannel*>::iterator entry = this->channels.find(name);
+    return (entry != this->channels.end()) ? entry->second : NULL;
+  }
+
+  // **************************************************************************
+  // Instance Implementation
+  // **************************************************************************
+
+  /**
+   * Creates an instance that compiles a program into its own memory and
+   * runs it headless on its own thread. Instances talk to each other
+   * through channels.
+   * @param program The name of the program.
+   * @param size The size of the memory.
+   * @param start The start address of the program.
+   * @param heap_size The number of blocks at the end of memory for the heap,
+   * or 0 for all memory above the program.
+   * @param quota The resource limits of the instance.
+   */
+  cInstance::cInstance(std::string program, int size, int start, int heap_size, sQuota quota) :
+    memory(size, heap_size),
+    simulator(&memory, &io, start) {
+    this->program = program;
+    this->simulator.quota = quota;
+    this->running = true;
+    this->thread = std::thread(&cInstance::Work, this);
+  }
+
+  /**
+   * Stops the instance and waits for its thread.
+   */
+  cInstance::~cInstance() {
+    this->running = false;
+    this->thread.join();
+  }
+
+  /**
+   * Compiles the program, then runs it in slices until it stops. A blocked
+   * program yields its core and sleeps if it stays blocked.
+   */
+  void cInstance::Work() {
+    int spins = 0;
+    try {
+      cCompiler compiler(this->program, &this->memory);
+      while (this->running && (this->simulator.status != eSTATUS_DONE)) {
+        this->simulator.Run(INSTANCE_SLICE);
+        if (this->simulator.blocked) {
+          if (++spins < INSTANCE_SPIN_LIMIT) {
+            std::this_thread::yield();
+          }
+          else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        }
+        else {
+          spins = 0;
+        }
+      }
+    }
+    catch (cError error) {
+      error.Print();
+    }
+    catch (std::exception& error) {
+      std::cout << "Instance " << this->program << " stopped: " << error.what() << std::endl;
+    }
+  }
+
+  // **************************************************************************
+  // I/O Worker Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a worker thread for file loads and saves.
+   */
+  cIO_Worker::cIO_Worker() {
+    this->completed = 0;
+    this->running = true;
+    this->thread = std::thread(&cIO_Worker::Work, this);
+  }
+
+  /**
+   * Finishes the queued jobs and stops the worker thread.
+   */
+  cIO_Worker::~cIO_Worker() {
+    {
+      std::lock_guard<std::mutex> guard(this->lock);
+      this->running = false;
+    }
+    this->signal.notify_all();
+    this->thread.join();
+  }
+
+  /**
+   * Queues a job.
+   * @param job The job to run.
+   */
+  void cIO_Worker::Add(sIO_Job& job) {
+    {
+      std::lock_guard<std::mutex> guard(this->lock);
+      this->jobs.push_back(job);
+    }
+    this->signal.notify_one();
+  }
+
+  /**
+   * Takes a finished job.
+   * @param job Receives the job.
+   * @return True if a job was taken, false otherwise.
+   */
+  bool cIO_Worker::Take(sIO_Job& job) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    bool taken = false;
+    if (this->done.size() > 0) {
+      job = this->done.front();
+      this->done.pop_front();
+      this->completed--;
+      taken = true;
+    }
+    return taken;
+  }
+
+  /**
+   * Runs the jobs in order until the worker is stopped.
+   */
+  void cIO_Worker::Work() {
+    while (true) {
+      sIO_Job job;
+      {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->signal.wait(guard, [this]() {
+          return (!this->running || (this->jobs.size() > 0));
+        });
+        if (this->jobs.size() == 0) {
+          break;
+        }
+        job = this->jobs.front();
+        this->jobs.pop_front();
+      }
+      cIO_Worker::Run_Job(job);
+      std::lock_guard<std::mutex> guard(this->lock);
+      this->done.push_back(job);
+      this->completed++;
+    }
+  }
+
+  /**
+   * Runs a load or save job.
+   * @param job The job to run.
+   */
+  void cIO_Worker::Run_Job(sIO_Job& job) {
+    auto start = std::chrono::steady_clock::now();
+    if (job.type == eIO_LOAD) {
+      job.success = Read_Objects(job.name, job.objects);
+    }
+    else {
+      job.success = Write_Objects(job.name, job.objects);
+      job.objects.clear();
+    }
+    job.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // **************************************************************************
+  // Recorder Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a new recorder. Each slice starts with a line holding the
+   * frame stats the script sees (s), has one line per input event (i),
+   * random draw (r) and channel send or receive (m), and ends with a line
+   * holding the number of instructions run and the clock (f).
+   * @param name The name of the log file.
+   * @param mode Either eRECORD_WRITE or eRECORD_REPLAY.
+   * @throws An error if the log could not be opened.
+   */
+  cRecorder::cRecorder(std::string name, int mode) {
+    this->mode = mode;
+    this->slice_index = 0;
+    this->random_index = 0;
+    this->message_index = 0;
+    if (mode == eRECORD_WRITE) {
+      this->file.open(name);
+      if (!this->file) {
+        throw cError("Could not write log " + name + ".");
+      }
+      this->file << "clsh-replay 1\n";
+    }
+    else {
+      std::ifstream log(name);
+      std::string line;
+      if (!log || !std::getline(log, line) || (line != "clsh-replay 1")) {
+        throw cError("Could not read log " + name + ".");
+      }
+      sReplay_Slice slice = {};
+      while (std::getline(log, line)) {
+        std::istringstream fields(line);
+        std::string tag;
+        fields >> tag;
+        if (tag == "s") {
+          fields >> slice.stats.frames >> slice.stats.fps >> slice.stats.frame_time >> slice.stats.script_time >> slice.stats.render_time >> slice.stats.budget;
+        }
+        else if (tag == "i") {
+          int code = 0;
+          fields >> code;
+          slice.events.push_back(code);
+        }
+        else if (tag == "r") {
+          int number = 0;
+          fields >> number;
+          slice.randoms.push_back(number);
+        }
+        else if (tag == "m") {
+          std::string message;
+          std::getline(fields >> std::ws, message); // Strings may hold spaces.
+          slice.messages.push_back(message);
+        }
+        else if (tag == "f") {
+          fields >> slice.count >> slice.time;
+          this->slices.push_back(slice);
+          slice = {};
+        }
+      }
+    }
+  }
+
+  /**
+   * Determines if there is a slice left to replay.
+   * @return True if there is a slice, false otherwise.
+   */
+  bool cRecorder::Has_Slice() {
+    return ((this->mode == eRECORD_REPLAY) && (this->slice_index < (int)this->slices.size()));
+  }
+
+  /**
+   * Begins a slice. The frame stats are recorded since they come from the
+   * wall clock. On replay the clock, the frame stats and the input events
+   * of the slice are restored.
+   * @param clock The simulator clock.
+   * @param events The simulator event queue.
+   * @param stats The simulator frame stats.
+   */
+  void cRecorder::Begin_Slice(long long& clock, std::deque<sInput_Event>& events, sFrame_Stats& stats) {
+    if (this->mode == eRECORD_WRITE) {
+      this->file << "s " << stats.frames << " " << stats.fps << " " << stats.frame_time << " " << stats.script_time << " " << stats.render_time << " " << stats.budget << "\n";
+    }
+    if (this->Has_Slice()) {
+      sReplay_Slice& slice = this->slices[this->slice_index];
+      clock = slice.time;
+      stats = slice.stats;
+      int event_count = slice.events.size();
+      for (int event_index = 0; event_index < event_count; event_index++) {
+        sInput_Event event = { slice.events[event_index], clock };
+        events.push_back(event);
+        if (events.size() > INPUT_QUEUE_LIMIT) {
+          events.pop_front();
+        }
+      }
+      this->random_index = 0;
+      this->message_index = 0;
+      this->slice_index++;
+    }
+  }
+
+  /**
+   * Records an input event.
+   * @param code The signal code.
+   */
+  void cRecorder::Record_Event(int code) {
+    if (this->mode == eRECORD_WRITE) {
+      this->file << "i " << code << "\n";
+    }
+  }
+
+  /**
+   * Draws a random number from the I/O module or from the log.
+   * @param lower The lower bound.
+   * @param upper The upper bound.
+   * @param io The I/O module.
+   * @return The random number.
+   * @throws An error if the log has no more draws for the slice.
+   */
+  int cRecorder::Random(int lower, int upper, cIO_Control* io) {
+    int number = 0;
+    if (this->mode == eRECORD_WRITE) {
+      number = io->Get_Random_Number(lower, upper);
+      this->file << "r " << number << "\n";
+    }
+    else {
+      sReplay_Slice& slice = this->slices[this->slice_index - 1];
+      if (this->random_index >= (int)slice.randoms.size()) {
+        throw cError("Replay ran out of random numbers.");
+      }
+      number = slice.randoms[this->random_index++];
+    }
+    return number;
+  }
+
+  /**
+   * Records the outcome of a channel send or receive. A message that went
+   * through is kept with its value, a full or empty channel as a dash.
+   * @param done True if the message went through, false otherwise.
+   * @param value The message.
+   */
+  void cRecorder::Record_Message(bool done, const cScript_Value& value) {
+    if (this->mode == eRECORD_WRITE) {
+      if (!done) {
+        this->file << "m -\n";
+      }
+      else if (value.type == eVALUE_NUMBER) {
+        this->file << "m #" << value.number << "\n";
+      }
+      else {
+        this->file << "m $" << Escape_Field(value.Get_String()) << "\n";
+      }
+    }
+  }
+
+  /**
+   * Replays the outcome of a channel send or receive from the log.
+   * @param value Receives the message.
+   * @return True if the message went through, false otherwise.
+   * @throws An error if the log has no more messages for the slice.
+   */
+  bool cRecorder::Replay_Message(cScript_Value& value) {
+    sReplay_Slice& slice = this->slices[this->slice_index - 1];
+    if (this->message_index >= (int)slice.messages.size()) {
+      throw cError("Replay ran out of messages.");
+    }
+    std::string message = slice.messages[this->message_index++];
+    bool done = (message != "-");
+    if (done && (message[0] == '#')) {
+      value.Set_Number(std::atoi(message.substr(1).c_str()));
+    }
+    else if (done) {
+      value.Set_String(Unescape_Field(message.substr(1)));
+    }
+    return done;
+  }
+
+  /**
+   * Ends a recorded slice.
+   * @param count The number of instructions that were run.
+   * @param clock The simulator clock of the slice.
+   */
+  void cRecorder::End_Slice(int count, long long clock) {
+    if (this->mode == eRECORD_WRITE) {
+      this->file << "f " << count << " " << clock << "\n";
+    }
+  }
+
+  /**
+   * Gets the number of instructions of the next slice to replay.
+   * @return The number of instructions.
+   */
+  int cRecorder::Get_Count() {
+    return this->Has_Slice() ? this->slices[this->slice_index].count : 0;
+  }
+
+  // **************************************************************************
+  // Headless I/O Implementation
+  // **************************************************************************
+
+  /**
+   * Creates an I/O module that does no drawing, sound or input.
+   */
+  cHeadless_IO::cHeadless_IO() {
+    this->draws = 0;
+    this->refreshes = 0;
+  }
+
+  /**
+   * Counts a text output.
+   */
+  void cHeadless_IO::Output_Text(std::string text, int x, int y, int red, int green, int blue) {
+    this->draws++;
+  }
+
+  /**
+   * Counts an image draw.
+   */
+  void cHeadless_IO::Draw_Image(std::string name, int x, int y, int width, int height, int angle, bool flip_x, bool flip_y) {
+    this->draws++;
+  }
+
+  /**
+   * Counts a refresh.
+   */
+  void cHeadless_IO::Refresh() {
+    this->refreshes++;
+  }
+
+  /**
+   * Does not play a sound.
+   */
+  void cHeadless_IO::Play_Sound(std::string name) {
+    // Do nothing.
+  }
+
+  /**
+   * Does not play music.
+   */
+  void cHeadless_IO::Play_Music(std::string name) {
+    // Do nothing.
+  }
+
+  /**
+   * Does not stop sound.
+   */
+  void cHeadless_IO::Silence() {
+    // Do nothing.
+  }
+
+  /**
+   * Reads no signal. Input comes from the replay log.
+   * @return The empty signal.
+   */
+  sSignal cHeadless_IO::Read_Signal() {
+    sSignal signal;
+    signal.code = INPUT_NONE;
+    return signal;
+  }
+
+  /**
+   * Does not wait so replays run at full speed.
+   */
+  void cHeadless_IO::Timeout(int timeout) {
+    // Do nothing.
+  }
+
+  /**
+   * Does not clear the screen.
+   */
+  void cHeadless_IO::Color(int red, int green, int blue) {
+    // Do nothing.
+  }
+
+  // **************************************************************************
+  // Software I/O Implementation
+  // **************************************************************************
+
+  // Dots of the characters from space to underscore, 3 wide and 5 high,
+  // read left to right and top to bottom from the highest bit.
+  const unsigned short FONT_GLYPHS[64] = {
+    0x0000, 0x2482, 0x5A00, 0x5F7D, 0x3C9E, 0x52A5, 0x2AAB, 0x2400,
+    0x1491, 0x4494, 0x0AA8, 0x05D0, 0x0014, 0x01C0, 0x0002, 0x12A4,
+    0x7B6F, 0x2C97, 0x73E7, 0x72CF, 0x5BC9, 0x79CF, 0x79EF, 0x7292,
+    0x7BEF, 0x7BCF, 0x0410, 0x0414, 0x1511, 0x0E38, 0x4454, 0x72C2,
+    0x7BE7, 0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B,
+    0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D, 0x2B6A,
+    0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F, 0x5B6A, 0x5BFD,
+    0x5AAD, 0x5A92, 0x72A7, 0x3493, 0x4889, 0x6496, 0x2A00, 0x0007
+  };
+
+  /**
+   * Creates an I/O module that draws into a framebuffer in memory. Each
+   * refresh compares the frame with the last one tile by tile and keeps
+   * the changed regions as dirty rectangles.
+   * @param width The width of the frame.
+   * @param height The height of the frame.
+   */
+  cSoftware_IO::cSoftware_IO(int width, int height) {
+    this->width = width;
+    this->height = height;
+    this->pixels = std::vector<unsigned int>(width * height, 0);
+    this->shown = std::vector<unsigned int>(width * height, 0);
+    this->repainted = 0;
+  }
+
+  /**
+   * Draws text with the built in font. Lower case is drawn as upper case.
+   * @param text The text.
+   * @param x The x coordinate.
+   * @param y The y coordinate.
+   * @param red The red component.
+   * @param green The green component.
+   * @param blue The blue component.
+   */
+  void cSoftware_IO::Output_Text(std::string text, int x, int y, int red, int green, int blue) {
+    this->draws++;
+    unsigned int color = ((red & 0xFF) << 16) | ((green & 0xFF) << 8) | (blue & 0xFF);
+    int char_count = text.length();
+    for (int char_index = 0; char_index < char_count; char_index++) {
+      int letter = std::toupper((unsigned char)text[char_index]);
+      unsigned short glyph = ((letter >= 32) && (letter < 96)) ? FONT_GLYPHS[letter - 32] : FONT_GLYPHS['?' - 32];
+      int left = x + (char_index * 4 * FONT_SCALE);
+      for (int dot = 0; dot < 15; dot++) {
+        if (glyph & (0x4000 >> dot)) {
+          this->Fill_Rect(left + ((dot % 3) * FONT_SCALE), y + ((dot / 3) * FONT_SCALE), FONT_SCALE, FONT_SCALE, color);
+        }
+      }
+    }
+  }
+
+  /**
+   * Draws an image. Images drawn at their own size without rotation take
+   * the row copy path, others are sampled.
+   * @param name The name of the image.
+   * @param x The x coordinate.
+   * @param y The y coordinate.
+   * @param width The width to draw at.
+   * @param height The height to draw at.
+   * @param angle The angle in degrees.
+   * @param flip_x True to flip left to right.
+   * @param flip_y True to flip top to bottom.
+   */
+  void cSoftware_IO::Draw_Image(std::string name, int x, int y, int width, int height, int angle, bool flip_x, bool flip_y) {
+    this->draws++;
+    sSoftware_Image& image = this->Get_Image(name);
+    if (image.width == 0) {
+      this->Fill_Rect(x, y, width, height, SOFTWARE_MISSING);
+    }
+    else if ((width == image.width) && (height == image.height) && ((angle % 360) == 0)) {
+      this->Blit(image, x, y, flip_x, flip_y);
+    }
+    else {
+      this->Blit_Transformed(image, x, y, width, height, angle, flip_x, flip_y);
+    }
+  }
+
+  /**
+   * Finds the tiles that changed since the last refresh. Changed tiles
+   * next to each other on a row are merged into one rectangle, then the
+   * rectangles are copied to the shown frame.
+   */
+  void cSoftware_IO::Refresh() {
+    this->refreshes++;
+    this->dirty.clear();
+    for (int tile_y = 0; tile_y < this->height; tile_y += SOFTWARE_TILE) {
+      int rows = std::min(SOFTWARE_TILE, this->height - tile_y);
+      int run = -1; // Left edge of the changed tiles so far.
+      for (int tile_x = 0; tile_x < this->width; tile_x += SOFTWARE_TILE) {
+        int columns = std::min(SOFTWARE_TILE, this->width - tile_x);
+        bool changed = false;
+        for (int row = 0; (row < rows) && !changed; row++) {
+          int offset = ((tile_y + row) * this->width) + tile_x;
+          changed = (std::memcmp(&this->pixels[offset], &this->shown[offset], columns * sizeof(unsigned int)) != 0);
+        }
+        if (changed && (run < 0)) {
+          run = tile_x;
+        }
+        else if (!changed && (run >= 0)) {
+          this->dirty.push_back({ run, tile_y, tile_x - run, rows });
+          run = -1;
+        }
+      }
+      if (run >= 0) { // The run reaches the right edge.
+        this->dirty.push_back({ run, tile_y, this->width - run, rows });
+      }
+    }
+    int rect_count = this->dirty.size();
+    for (int rect_index = 0; rect_index < rect_count; rect_index++) {
+      sDirty_Rect& rect = this->dirty[rect_index];
+      for (int row = rect.y; row < rect.y + rect.height; row++) {
+        int offset = (row * this->width) + rect.x;
+        std::copy(&this->pixels[offset], &this->pixels[offset] + rect.width, &this->shown[offset]);
+      }
+      this->repainted += rect.width * rect.height;
+    }
+  }
+
+  /**
+   * Clears the frame to a color.
+   * @param red The red component.
+   * @param green The green component.
+   * @param blue The blue component.
+   */
+  void cSoftware_IO::Color(int red, int green, int blue) {
+    unsigned int color = ((red & 0xFF) << 16) | ((green & 0xFF) << 8) | (blue & 0xFF);
+    std::fill(this->pixels.begin(), this->pixels.end(), color);
+  }
+
+  /**
+   * Gets an image, loading it from its bitmap file the first time. An
+   * image that could not be loaded has no size.
+   * @param name The name of the image.
+   * @return The image.
+   */
+  sSoftware_Image& cSoftware_IO::Get_Image(std::string name) {
+    std::unordered_map<std::string, sSoftware_Image>::iterator entry = this->images.find(name);
+    if (entry != this->images.end()) {
+      return entry->second;
+    }
+    sSoftware_Image& image = this->images[name];
+    if (!Read_Bitmap(name + ".bmp", image)) {
+      std::cout << "Could not load image " << name << "." << std::endl;
+      image = { 0, 0, true, std::vector<unsigned int>() };
+    }
+    return image;
+  }
+
+  /**
+   * Fills a rectangle clipped to the frame.
+   * @param x The x coordinate.
+   * @param y The y coordinate.
+   * @param width The width.
+   * @param height The height.
+   * @param color The color.
+   */
+  void cSoftware_IO::Fill_Rect(int x, int y, int width, int height, unsigned int color) {
+    int left = std::max(0, x);
+    int top = std::max(0, y);
+    int right = std::min(this->width, x + width);
+    int bottom = std::min(this->height, y + height);
+    for (int row = top; row < bottom; row++) {
+      unsigned int* dest = &this->pixels[row * this->width];
+      std::fill(dest + left, dest + right, color);
+    }
+  }
+
+  /**
+   * Copies an image to the frame at its own size. Opaque rows are copied
+   * whole, others select between source and destination per pixel in a
+   * loop the compiler can vectorize.
+   * @param image The image.
+   * @param x The x coordinate.
+   * @param y The y coordinate.
+   * @param flip_x True to flip left to right.
+   * @param flip_y True to flip top to bottom.
+   */
+  void cSoftware_IO::Blit(sSoftware_Image& image, int x, int y, bool flip_x, bool flip_y) {
+    int left = std::max(0, x);
+    int top = std::max(0, y);
+    int right = std::min(this->width, x + image.width);
+    int bottom = std::min(this->height, y + image.height);
+    int span = right - left;
+    if ((span <= 0) || (top >= bottom)) { // Fully off the frame.
+      return;
+    }
+    for (int row = top; row < bottom; row++) {
+      int source_row = flip_y ? (image.height - 1 - (row - y)) : (row - y);
+      const unsigned int* source = &image.pixels[source_row * image.width];
+      unsigned int* dest = &this->pixels[(row * this->width) + left];
+      if (flip_x) {
+        const unsigned int* end = source + image.width - 1 - (left - x);
+        for (int column = 0; column < span; column++) {
+          unsigned int pixel = *(end - column);
+          dest[column] = (pixel == SOFTWARE_KEY) ? dest[column] : pixel;
+        }
+      }
+      else if (image.opaque) {
+        std::memcpy(dest, source + (left - x), span * sizeof(unsigned int));
+      }
+      else {
+        const unsigned int* start = source + (left - x);
+        for (int column = 0; column < span; column++) {
+          unsigned int pixel = start[column];
+          dest[column] = (pixel == SOFTWARE_KEY) ? dest[column] : pixel;
+        }
+      }
+    }
+  }
+
+  /**
+   * Draws an image scaled and rotated about its center. Each covered
+   * pixel of the frame is mapped back into the image and the nearest
+   * image pixel is taken.
+   * @param image The image.
+   * @param x The x coordinate.
+   * @param y The y coordinate.
+   * @param width The width to draw at.
+   * @param height The height to draw at.
+   * @param angle The angle in degrees.
+   * @param flip_x True to flip left to right.
+   * @param flip_y True to flip top to bottom.
+   */
+  void cSoftware_IO::Blit_Transformed(sSoftware_Image& image, int x, int y, int width, int height, int angle, bool flip_x, bool flip_y) {
+    if ((width <= 0) || (height <= 0)) {
+      return;
+    }
+    double radians = (double)angle * 3.14159265358979 / 180.0;
+    double cosine = std::cos(radians);
+    double sine = std::sin(radians);
+    double center_x = x + (width / 2.0);
+    double center_y = y + (height / 2.0);
+    double extent_x = ((std::abs(cosine) * width) + (std::abs(sine) * height)) / 2.0;
+    double extent_y = ((std::abs(sine) * width) + (std::abs(cosine) * height)) / 2.0;
+    int left = std::max(0, (int)std::floor(center_x - extent_x));
+    int top = std::max(0, (int)std::floor(center_y - extent_y));
+    int right = std::min(this->width, (int)std::ceil(center_x + extent_x));
+    int bottom = std::min(this->height, (int)std::ceil(center_y + extent_y));
+    for (int row = top; row < bottom; row++) {
+      double offset_y = row + 0.5 - center_y;
+      for (int column = left; column < right; column++) {
+        double offset_x = column + 0.5 - center_x;
+        double u = (offset_x * cosine) + (offset_y * sine) + (width / 2.0);
+        double v = (offset_y * cosine) - (offset_x * sine) + (height / 2.0);
+        if ((u >= 0) && (u < width) && (v >= 0) && (v < height)) {
+          int source_x = (int)(u * image.width / width);
+          int source_y = (int)(v * image.height / height);
+          if (flip_x) {
+            source_x = image.width - 1 - source_x;
+          }
+          if (flip_y) {
+            source_y = image.height - 1 - source_y;
+          }
+          unsigned int pixel = image.pixels[(source_y * image.width) + source_x];
+          if (pixel != SOFTWARE_KEY) {
+            this->pixels[(row * this->width) + column] = pixel;
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Writes the shown frame to an image file. Names ending in .ppm are
+   * written as portable pixmaps, others as bitmaps.
+   * @param name The name of the file.
+   * @return True if the file was written, false otherwise.
+   */
+  bool cSoftware_IO::Dump_Frame(std::string name) {
+    bool pixmap = (name.length() > 4) && (name.compare(name.length() - 4, 4, ".ppm") == 0);
+    return pixmap ? Write_Pixmap(name, this->shown, this->width, this->height) : Write_Bitmap(name, this->shown, this->width, this->height);
+  }
+
+  // **************************************************************************
+  // Spatial Hash Implementation
+  // **************************************************************************
+
+  /**
+   * Creates an empty spatial hash.
+   */
+  cSpatial_Hash::cSpatial_Hash() {
+    this->address = 0;
+    this->count = 0;
+    this->cell_size = 1;
+    this->query = 0;
+  }
+
+  /**
+   * Indexes a range of objects by their x, y, width and height fields.
+   * @param memory The memory module.
+   * @param address The address of the first object.
+   * @param count The number of objects.
+   * @param cell_size The width and height of a grid cell.
+   * @throws An error if the range is outside of memory.
+   */
+  void cSpatial_Hash::Build(cMemory* memory, int address, int count, int cell_size) {
+    this->address = address;
+    this->count = std::max(count, 0);
+    this->cell_size = std::max(cell_size, 1);
+    this->cells.clear();
+    this->oversized.clear();
+    this->entries.resize(this->count);
+    this->marks.assign(this->count, 0);
+    this->query = 0;
+    for (int entry_index = 0; entry_index < this->count; entry_index++) {
+      this->Read_Entry(memory, entry_index, this->entries[entry_index]);
+      this->Insert(entry_index);
+    }
+  }
+
+  /**
+   * Moves the objects written since they were last indexed. Objects that
+   * stay in the same cells are only updated in place.
+   * @param memory The memory module.
+   * @throws An error if the range is outside of memory.
+   */
+  void cSpatial_Hash::Update(cMemory* memory) {
+    for (int entry_index = 0; entry_index < this->count; entry_index++) {
+      sSpatial_Entry& entry = this->entries[entry_index];
+      if (memory->stamps[this->address + entry_index] > entry.stamp) {
+        sSpatial_Entry moved;
+        this->Read_Entry(memory, entry_index, moved);
+        if ((moved.left != entry.left) || (moved.top != entry.top) || (moved.right != entry.right) || (moved.bottom != entry.bottom)) {
+          this->Remove(entry_index);
+          entry = moved;
+          this->Insert(entry_index);
+        }
+        else {
+          entry = moved;
+        }
+      }
+    }
+  }
+
+  /**
+   * Finds the objects that overlap a rectangle. Each object is reported
+   * once, in address order. Rectangles that cover more cells than there
+   * are objects check every object instead of walking the cells.
+   * @param x The left of the rectangle.
+   * @param y The top of the rectangle.
+   * @param width The width of the rectangle.
+   * @param height The height of the rectangle.
+   * @param exclude The index of an object to leave out or -1.
+   * @param results Receives the indexes of the objects.
+   * @return The number of objects found.
+   */
+  int cSpatial_Hash::Query(int x, int y, int width, int height, int exclude, std::vector<int>& results) {
+    if (++this->query == 0) { // Marks wrapped around.
+      std::fill(this->marks.begin(), this->marks.end(), 0);
+      this->query = 1;
+    }
+    double left = std::floor((double)x / this->cell_size);
+    double top = std::floor((double)y / this->cell_size);
+    double right = std::floor(((double)x + std::max(width, 1) - 1) / this->cell_size);
+    double bottom = std::floor(((double)y + std::max(height, 1) - 1) / this->cell_size);
+    if ((right - left + 1) * (bottom - top + 1) > this->count) {
+      for (int index = 0; index < this->count; index++) {
+        this->Check_Entry(index, x, y, width, height, exclude, results);
+      }
+    }
+    else {
+      for (int row = (int)top; row <= (int)bottom; row++) {
+        for (int column = (int)left; column <= (int)right; column++) {
+          std::unordered_map<unsigned long long, std::vector<int>>::iterator cell = this->cells.find(this->Get_Key(column, row));
+          if (cell != this->cells.end()) {
+            std::vector<int>& items = cell->second;
+            int item_count = items.size();
+            for (int item_index = 0; item_index < item_count; item_index++) {
+              this->Check_Entry(items[item_index], x, y, width, height, exclude, results);
+            }
+          }
+        }
+      }
+      int oversized_count = this->oversized.size();
+      for (int oversized_index = 0; oversized_index < oversized_count; oversized_index++) {
+        this->Check_Entry(this->oversized[oversized_index], x, y, width, height, exclude, results);
+      }
+    }
+    std::sort(results.begin(), results.end());
+    return results.size();
+  }
+
+  /**
+   * Reads the bounds of an object and the cells it covers.
+   * @param memory The memory module.
+   * @param index The index of the object.
+   * @param entry Receives the bounds.
+   * @throws An error if the object is outside of memory.
+   */
+  void cSpatial_Hash::Read_Entry(cMemory* memory, int index, sSpatial_Entry& entry) {
+    cBlock& block = (*memory)[this->address + index];
+    entry.x = block.fields.Does_Key_Exist("x") ? block.fields["x"].number : 0;
+    entry.y = block.fields.Does_Key_Exist("y") ? block.fields["y"].number : 0;
+    entry.width = block.fields.Does_Key_Exist("width") ? block.fields["width"].number : 0;
+    entry.height = block.fields.Does_Key_Exist("height") ? block.fields["height"].number : 0;
+    entry.left = (int)std::floor((double)entry.x / this->cell_size);
+    entry.top = (int)std::floor((double)entry.y / this->cell_size);
+    entry.right = (int)std::floor(((double)entry.x + std::max(entry.width, 1) - 1) / this->cell_size);
+    entry.bottom = (int)std::floor(((double)entry.y + std::max(entry.height, 1) - 1) / this->cell_size);
+    entry.oversized = ((double)entry.right - entry.left + 1) * ((double)entry.bottom - entry.top + 1) > SPATIAL_CELL_LIMIT;
+    entry.stamp = memory->stamps[this->address + index];
+  }
+
+  /**
+   * Adds an object to the cells it covers. Objects covering too many cells
+   * are kept in a separate list that every query checks.
+   * @param index The index of the object.
+   */
+  void cSpatial_Hash::Insert(int index) {
+    sSpatial_Entry& entry = this->entries[index];
+    if (entry.oversized) {
+      this->oversized.push_back(index);
+      return;
+    }
+    for (int row = entry.top; row <= entry.bottom; row++) {
+      for (int column = entry.left; column <= entry.right; column++) {
+        this->cells[this->Get_Key(column, row)].push_back(index);
+      }
+    }
+  }
+
+  /**
+   * Takes an object out of the cells it covers. Cells left empty are
+   * dropped.
+   * @param index The index of the object.
+   */
+  void cSpatial_Hash::Remove(int index) {
+    sSpatial_Entry& entry = this->entries[index];
+    if (entry.oversized) {
+      std::vector<int>::iterator item = std::find(this->oversized.begin(), this->oversized.end(), index);
+      if (item != this->oversized.end()) {
+        *item = this->oversized.back();
+        this->oversized.pop_back();
+      }
+      return;
+    }
+    for (int row = entry.top; row <= entry.bottom; row++) {
+      for (int column = entry.left; column <= entry.right; column++) {
+        std::unordered_map<unsigned long long, std::vector<int>>::iterator cell = this->cells.find(this->Get_Key(column, row));
+        if (cell != this->cells.end()) {
+          std::vector<int>& items = cell->second;
+          std::vector<int>::iterator item = std::find(items.begin(), items.end(), index);
+          if (item != items.end()) {
+            *item = items.back();
+            items.pop_back();
+          }
+          if (items.empty()) {
+            this->cells.erase(cell);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Adds an object to the results if it overlaps a rectangle and was not
+   * already checked by this query.
+   * @param index The index of the object.
+   * @param x The left of the rectangle.
+   * @param y The top of the rectangle.
+   * @param width The width of the rectangle.
+   * @param height The height of the rectangle.
+   * @param exclude The index of an object to leave out or -1.
+   * @param results Receives the index of the object.
+   */
+  void cSpatial_Hash::Check_Entry(int index, int x, int y, int width, int height, int exclude, std::vector<int>& results) {
+    if ((index != exclude) && (this->marks[index] != this->query)) {
+      this->marks[index] = this->query;
+      sSpatial_Entry& entry = this->entries[index];
+      if ((entry.x < (long long)x + width) && (x < (long long)entry.x + entry.width) && (entry.y < (long long)y + height) && (y < (long long)entry.y + entry.height)) {
+        results.push_back(index);
+      }
+    }
+  }
+
+  /**
+   * Gets the key of a grid cell.
+   * @param column The column of the cell.
+   * @param row The row of the cell.
+   * @return The key.
+   */
+  unsigned long long cSpatial_Hash::Get_Key(int column, int row) {
+    return ((unsigned long long)(unsigned int)column << 32) | (unsigned int)row;
+  }
+
+  // **************************************************************************
+  // Pathfinder Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a pathfinder. Its buffers grow to the largest grid searched
+   * and are kept between searches.
+   */
+  cPathfinder::cPathfinder() {
+    this->searches.reserve(PATH_SEARCH_LIMIT);
+    this->flow = {};
+    this->flow.list = -1;
+    this->flow.grid = -1;
+    this->flow.start = -1;
+    this->flow.goal = -1;
+    this->uses = 0;
+  }
+
+  /**
+   * Finds the shortest path on a grid with A*. Cells holding 0 are
+   * walkable and moves go up, down, left and right. Each destination list
+   * has its own search. If the node budget runs out the search is kept and
+   * continued by the next call for the same list, grid, start and goal.
+   * @param memory The memory module.
+   * @param list The address of the destination list, which names the search.
+   * @param grid The address of the grid, stored row by row.
+   * @param columns The number of columns in the grid.
+   * @param rows The number of rows in the grid.
+   * @param start The index of the start cell.
+   * @param goal The index of the goal cell.
+   * @param budget The most cells to expand in this call or 0 for no limit.
+   * @return The number of steps in the path, ePATH_NONE if there is no
+   * path, ePATH_SEARCHING if the budget ran out or ePATH_RESTARTED if the
+   * budget ran out after a search in progress for the list was dropped
+   * because the grid, start or goal changed.
+   * @throws An error if the grid is outside of memory.
+   */
+  int cPathfinder::Find_Path(cMemory* memory, int list, int grid, int columns, int rows, int start, int goal, int budget) {
+    sPath_Search& search = this->Get_Search(list);
+    int cell_count = columns * rows;
+    if ((columns <= 0) || (rows <= 0) || (start < 0) || (start >= cell_count) || (goal < 0) || (goal >= cell_count)) {
+      search.searching = false;
+      return ePATH_NONE;
+    }
+    (*memory)[grid]; // Check both ends of the grid.
+    (*memory)[grid + cell_count - 1];
+    cBlock* cells = memory->memory + grid;
+    int status = ePATH_SEARCHING;
+    if (!search.searching || (grid != search.grid) || (columns != search.columns) || (rows != search.rows) || (start != search.start) || (goal != search.goal)) {
+      if (search.searching) {
+        status = ePATH_RESTARTED;
+      }
+      this->Begin(search, grid, columns, rows);
+      search.start = start;
+      search.goal = goal;
+      if ((cells[start].value.number != 0) || (cells[goal].value.number != 0)) {
+        return ePATH_NONE;
+      }
+      search.visits[start] = search.search;
+      search.costs[start] = 0;
+      search.parents[start] = -1;
+      search.open.push_back(std::make_pair(this->Get_Distance(search, start), start));
+      search.searching = true;
+    }
+    int expanded = 0;
+    while (search.open.size() > 0) {
+      if ((budget > 0) && (expanded >= budget)) {
+        return status;
+      }
+      std::pop_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int, int>>());
+      int cell = search.open.back().second;
+      search.open.pop_back();
+      if (search.closed[cell] != search.search) {
+        search.closed[cell] = search.search;
+        expanded++;
+        if (cell == goal) {
+          this->path.clear();
+          for (int step = goal; step != start; step = search.parents[step]) {
+            this->path.push_back(step);
+          }
+          std::reverse(this->path.begin(), this->path.end());
+          search.searching = false;
+          return this->path.size();
+        }
+        int column = cell % columns;
+        int neighbors[4] = {
+          (cell >= columns) ? cell - columns : -1,
+          (column < columns - 1) ? cell + 1 : -1,
+          (cell < cell_count - columns) ? cell + columns : -1,
+          (column > 0) ? cell - 1 : -1
+        };
+        for (int neighbor_index = 0; neighbor_index < 4; neighbor_index++) {
+          int neighbor = neighbors[neighbor_index];
+          if ((neighbor >= 0) && (cells[neighbor].value.number == 0) && (search.closed[neighbor] != search.search)) {
+            int cost = search.costs[cell] + 1;
+            if ((search.visits[neighbor] != search.search) || (cost < search.costs[neighbor])) {
+              search.visits[neighbor] = search.search;
+              search.costs[neighbor] = cost;
+              search.parents[neighbor] = cell;
+              search.open.push_back(std::make_pair(cost + this->Get_Distance(search, neighbor), neighbor));
+              std::push_heap(search.open.begin(), search.open.end(), std::greater<std::pair<int, int>>());
+            }
+          }
+        }
+      }
+    }
+    search.searching = false;
+    return ePATH_NONE;
+  }
+
+  /**
+   * Builds a flow field toward a goal with a breadth first search. Each
+   * cell gets the direction of the next step to the goal, or eDIR_NONE
+   * for the goal and cells that cannot reach it.
+   * @param memory The memory module.
+   * @param grid The address of the grid, stored row by row.
+   * @param columns The number of columns in the grid.
+   * @param rows The number of rows in the grid.
+   * @param goal The index of the goal cell.
+   * @throws An error if the grid is outside of memory.
+   */
+  void cPathfinder::Flow_Field(cMemory* memory, int grid, int columns, int rows, int goal) {
+    int cell_count = std::max(columns, 0) * std::max(rows, 0);
+    this->directions.assign(cell_count, eDIR_NONE);
+    if ((cell_count > 0) && (goal >= 0) && (goal < cell_count)) {
+      (*memory)[grid]; // Check both ends of the grid.
+      (*memory)[grid + cell_count - 1];
+      cBlock* cells = memory->memory + grid;
+      sPath_Search& search = this->flow;
+      this->Begin(search, grid, columns, rows);
+      if (cells[goal].value.number == 0) {
+        this->path.clear(); // Used as the queue.
+        this->path.push_back(goal);
+        search.visits[goal] = search.search;
+        for (int queue_index = 0; queue_index < (int)this->path.size(); queue_index++) {
+          int cell = this->path[queue_index];
+          int column = cell % columns;
+          int neighbors[4] = {
+            (cell >= columns) ? cell - columns : -1,
+            (column < columns - 1) ? cell + 1 : -1,
+            (cell < cell_count - columns) ? cell + columns : -1,
+            (column > 0) ? cell - 1 : -1
+          };
+          int toward[4] = { eDIR_DOWN, eDIR_LEFT, eDIR_UP, eDIR_RIGHT }; // From the neighbor back to this cell.
+          for (int neighbor_index = 0; neighbor_index < 4; neighbor_index++) {
+            int neighbor = neighbors[neighbor_index];
+            if ((neighbor >= 0) && (cells[neighbor].value.number == 0) && (search.visits[neighbor] != search.search)) {
+              search.visits[neighbor] = search.search;
+              this->directions[neighbor] = toward[neighbor_index];
+              this->path.push_back(neighbor);
+            }
+          }
+        }
+        this->path.clear();
+      }
+    }
+  }
+
+  /**
+   * Gets the search of a destination list. A list without one takes an
+   * idle search, a new one if there are fewer than PATH_SEARCH_LIMIT, or
+   * else the least recently used, whose progress is dropped.
+   * @param list The address of the destination list.
+   * @return The search.
+   */
+  sPath_Search& cPathfinder::Get_Search(int list) {
+    int found = -1;
+    int idle = -1;
+    int oldest = -1;
+    int search_count = this->searches.size();
+    for (int search_index = 0; search_index < search_count; search_index++) {
+      sPath_Search& search = this->searches[search_index];
+      if (search.list == list) {
+        found = search_index;
+        break;
+      }
+      if (!search.searching && (idle == -1)) {
+        idle = search_index;
+      }
+      if ((oldest == -1) || (search.used < this->searches[oldest].used)) {
+        oldest = search_index;
+      }
+    }
+    if (found == -1) {
+      if (idle != -1) {
+        found = idle;
+      }
+      else if (search_count < PATH_SEARCH_LIMIT) {
+        sPath_Search search = {};
+        search.grid = -1;
+        search.start = -1;
+        search.goal = -1;
+        this->searches.push_back(search);
+        found = search_count;
+      }
+      else {
+        found = oldest;
+      }
+      this->searches[found].list = list;
+      this->searches[found].searching = false;
+    }
+    sPath_Search& search = this->searches[found];
+    search.used = ++this->uses;
+    return search;
+  }
+
+  /**
+   * Starts a new search. The visit marks are bumped instead of cleared.
+   * @param search The search.
+   * @param grid The address of the grid.
+   * @param columns The number of columns in the grid.
+   * @param rows The number of rows in the grid.
+   */
+  void cPathfinder::Begin(sPath_Search& search, int grid, int columns, int rows) {
+    int cell_count = columns * rows;
+    if ((int)search.visits.size() < cell_count) {
+      search.visits.resize(cell_count, 0);
+      search.closed.resize(cell_count, 0);
+      search.costs.resize(cell_count, 0);
+      search.parents.resize(cell_count, -1);
+    }
+    if (++search.search == 0) { // Marks wrapped around.
+      std::fill(search.visits.begin(), search.visits.end(), 0);
+      std::fill(search.closed.begin(), search.closed.end(), 0);
+      search.search = 1;
+    }
+    search.grid = grid;
+    search.columns = columns;
+    search.rows = rows;
+    search.open.clear();
+    search.searching = false;
+  }
+
+  /**
+   * Gets the Manhattan distance from a cell to the goal of a search.
+   * @param search The search.
+   * @param cell The index of the cell.
+   * @return The distance.
+   */
+  int cPathfinder::Get_Distance(sPath_Search& search, int cell) {
+    return std::abs((cell % search.columns) - (search.goal % search.columns)) + std::abs((cell / search.columns) - (search.goal / search.columns));
+  }
+
+  // **************************************************************************
+  // Frame Pacer Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a new frame pacer.
+   * @param fps The target frame rate.
+   */
+  cFrame_Pacer::cFrame_Pacer(int fps) {
+    this->target = 1000000 / ((fps > 0) ? fps : 60);
+    this->budget = this->target;
+    this->frame_time = this->target;
+    this->script_time = 0;
+    this->render_time = 0;
+    this->frame_script = 0;
+    this->frame_render = 0;
+    this->frames = 0;
+    this->frame_start = std::chrono::steady_clock::now();
+  }
+
+  /**
+   * Runs the simulator for the script budget of the frame. When the
+   * script refreshes, the rest of the frame is slept away, the frame costs
+   * are measured from one frame start to the next, and the budget is
+   * adapted to the render cost.
+   * @param simulator The simulator to run.
+   */
+  void cFrame_Pacer::Process(cSimulator* simulator) {
+    auto start = std::chrono::steady_clock::now();
+    simulator->Run(std::max(1, this->budget / 1000));
+    auto end = std::chrono::steady_clock::now();
+    long long run_time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    this->frame_script += run_time - simulator->render_time;
+    this->frame_render += simulator->render_time;
+    if (simulator->frame_done) {
+      std::this_thread::sleep_until(this->frame_start + std::chrono::microseconds(this->target));
+      auto next_start = std::chrono::steady_clock::now();
+      long long frame_time = std::chrono::duration_cast<std::chrono::microseconds>(next_start - this->frame_start).count(); // Includes the sleep.
+      this->frame_start = next_start;
+      // Smooth the measurements over the last few frames.
+      this->frame_time += (frame_time - this->frame_time) / 8.0;
+      this->script_time += (this->frame_script - this->script_time) / 8.0;
+      this->render_time += (this->frame_render - this->render_time) / 8.0;
+      this->frame_script = 0;
+      this->frame_render = 0;
+      this->frames++;
+      this->budget = std::min(this->target, std::max(1000, this->target - (int)this->render_time - PACE_MARGIN));
+      simulator->frame_stats.frames = this->frames;
+      simulator->frame_stats.fps = (int)(1000000.0 / std::max(1.0, this->frame_time));
+      simulator->frame_stats.frame_time = (int)this->frame_time;
+      simulator->frame_stats.script_time = (int)this->script_time;
+      simulator->frame_stats.render_time = (int)this->render_time;
+      simulator->frame_stats.budget = this->budget;
+    }
+    else if (simulator->blocked) { // Nothing to do until input arrives.
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  // **************************************************************************
+  // Thread Pool Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a new thread pool.
+   * @param count The number of worker threads. Jobs run on the calling
+   * thread if there are none.
+   */
+  cThread_Pool::cThread_Pool(int count) {
+    this->running = true;
+    for (int thread_index = 0; thread_index < count; thread_index++) {
+      this->workers.push_back(std::thread(&cThread_Pool::Work, this));
+    }
+  }
+
+  /**
+   * Stops the worker threads.
+   */
+  cThread_Pool::~cThread_Pool() {
+    {
+      std::lock_guard<std::mutex> guard(this->lock);
+      this->running = false;
+    }
+    this->signal.notify_all();
+    int thread_count = this->workers.size();
+    for (int thread_index = 0; thread_index < thread_count; thread_index++) {
+      this->workers[thread_index].join();
+    }
+  }
+
+  /**
+   * Runs a job for every index and waits for all of them to finish.
+   * @param count The number of indices.
+   * @param job The job to run with the index.
+   * @throws The first error thrown by a job.
+   */
+  void cThread_Pool::For_Each(int count, std::function<void(int)> job) {
+    if (this->workers.size() == 0) {
+      for (int index = 0; index < count; index++) {
+        job(index);
+      }
+      return;
+    }
+    std::mutex done_lock;
+    std::condition_variable done;
+    std::exception_ptr failure;
+    int remaining = count;
+    {
+      std::lock_guard<std::mutex> guard(this->lock);
+      for (int index = 0; index < count; index++) {
+        this->jobs.push_back([&, index]() {
+          try {
+            job(index);
+          }
+          catch (...) {
+            std::lock_guard<std::mutex> guard(done_lock);
+            if (!failure) {
+              failure = std::current_exception();
+            }
+          }
+          std::lock_guard<std::mutex> guard(done_lock);
+          if (--remaining == 0) {
+            done.notify_one();
+          }
+        });
+      }
+    }
+    this->signal.notify_all();
+    std::unique_lock<std::mutex> guard(done_lock);
+    done.wait(guard, [&]() {
+      return (remaining == 0);
+    });
+    if (failure) {
+      std::rethrow_exception(failure);
+    }
+  }
+
+  /**
+   * Runs jobs on a worker thread until the pool is stopped.
+   */
+  void cThread_Pool::Work() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->signal.wait(guard, [this]() {
+          return (!this->running || (this->jobs.size() > 0));
+        });
+        if (!this->running && (this->jobs.size() == 0)) {
+          break;
+        }
+        job = this->jobs.front();
+        this->jobs.pop_front();
+      }
+      job();
+    }
+  }
+
+  // **************************************************************************
+  // Utility Implementation
+  // **************************************************************************
+
+  /**
+   * Hashes text with FNV-1a. Hashes can be chained.
+   * @param text The text to hash.
+   * @param hash The hash to continue from, HASH_SEED to start.
+   * @return The new hash.
+   */
+  unsigned long long Hash_Text(std::string text, unsigned long long hash) {
+    int char_count = text.length();
+    for (int char_index = 0; char_index < char_count; char_index++) {
+      hash ^= (unsigned char)text[char_index];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  /**
+   * Parses a whole number without throwing.
+   * @param text The text to parse.
+   * @param number Receives the number if the text is a number.
+   * @return True if the text is a number, false otherwise.
+   */
+  bool Parse_Number(std::string text, int& number) {
+    int length = text.length();
+    int start = ((length > 0) && ((text[0] == '-') || (text[0] == '+'))) ? 1 : 0;
+    bool valid = (start < length);
+    long long result = 0;
+    for (int char_index = start; valid && (char_index < length); char_index++) {
+      char digit = text[char_index];
+      if ((digit >= '0') && (digit <= '9')) {
+        result = (result * 10) + (digit - '0');
+        valid = (result <= 2147483648LL); // Still fits when negated.
+      }
+      else {
+        valid = false;
+      }
+    }
+    if (valid) {
+      result = (text[0] == '-') ? -result : result;
+      valid = (result <= 2147483647LL);
+      if (valid) {
+        number = (int)result;
+      }
+    }
+    return valid;
+  }
+
+  /**
+   * Parses text into a value. Numbers become numeric values and anything
+   * else becomes a string. Only program literals are interned since the
+   * pool keeps its strings for the life of the program.
+   * @param text The text to parse.
+   * @param value The value to set.
+   * @param interned True to intern a string, false for a runtime string.
+   */
+  void Parse_Value(std::string text, cScript_Value& value, bool interned) {
+    int number = 0;
+    if (Parse_Number(text, number)) {
+      value.Set_Number(number);
+    }
+    else if (interned) {
+      value.Set_Interned(text);
+    }
+    else {
+      value.Set_String(text);
+    }
+  }
+
+  /**
+   * Reads the objects of a file. Patches in the journal of the file are
+   * applied on top so the objects match the last incremental save. Does
+   * not touch memory so it can run on any thread.
+   * @param name The name of the file.
+   * @param objects Receives the objects.
+   * @return True if the file was read, false otherwise.
+   */
+  bool Read_Objects(std::string name, std::vector<tObject>& objects) {
+    std::ifstream file(name);
+    bool success = (bool)file;
+    tObject object;
+    std::string line;
+    while (success && std::getline(file, line)) {
+      if (line == "object") {
+        object.Clear();
+      }
+      else if (line == "end") {
+        objects.push_back(object); // Go to next object.
+      }
+      else {
+        std::size_t equals = line.find('=');
+        if (equals != std::string::npos) {
+          Parse_Value(line.substr(equals + 1), object[line.substr(0, equals)], false);
+        }
+        else {
+          success = false;
+        }
+      }
+    }
+    std::ifstream journal(name + ".journal");
+    int patch = -1;
+    while (success && journal && std::getline(journal, line)) {
+      if (line.compare(0, 6, "patch ") == 0) {
+        object.Clear();
+        success = Parse_Number(line.substr(6), patch) && (patch >= 0);
+      }
+      else if (line == "end") {
+        if (patch >= (int)objects.size()) {
+          objects.resize(patch + 1);
+        }
+        objects[patch] = object;
+      }
+      else {
+        std::size_t equals = line.find('=');
+        if (equals != std::string::npos) {
+          Parse_Value(line.substr(equals + 1), object[line.substr(0, equals)], false);
+        }
+        else {
+          success = false;
+        }
+      }
+    }
+    return success;
+  }
+
+  /**
+   * Writes objects to a file. Does not touch memory so it can run on any
+   * thread.
+   * @param name The name of the file.
+   * @param objects The objects to write.
+   * @return True if the file was written, false otherwise.
+   */
+  bool Write_Objects(std::string name, std::vector<tObject>& objects) {
+    std::ofstream file(name);
+    bool success = (bool)file;
+    if (success) {
+      int object_count = objects.size();
+      for (int object_index = 0; object_index < object_count; object_index++) {
+        file << "object\n";
+        Write_Object(file, objects[object_index]);
+      }
+      success = (bool)file;
+    }
+    if (success) { // The whole file supersedes the journal.
+      std::error_code error;
+      std::filesystem::remove(name + ".journal", error);
+    }
+    return success;
+  }
+
+  /**
+   * Writes the fields of an object followed by its end marker.
+   * @param file The stream to write to.
+   * @param object The object to write.
+   */
+  void Write_Object(std::ostream& file, tObject& object) {
+    int key_count = object.Count();
+    for (int key_index = 0; key_index < key_count; key_index++) {
+      file << object.keys[key_index] << "=";
+      if (object.values[key_index].type == eVALUE_NUMBER) {
+        file << object.values[key_index].number << "\n";
+      }
+      else if (object.values[key_index].type == eVALUE_STRING) {
+        file << object.values[key_index].Get_String() << "\n";
+      }
+    }
+    file << "end\n";
+  }
+
+  /**
+   * Escapes the characters that would break a saved field line. The
+   * marker, "=", and line breaks become the marker and two hex digits.
+   * @param text The text to escape.
+   * @return The escaped text.
+   */
+  std::string Escape_Field(std::string text) {
+    static const char* digits = "0123456789ABCDEF";
+    std::string escaped;
+    int char_count = text.length();
+    for (int char_index = 0; char_index < char_count; char_index++) {
+      char letter = text[char_index];
+      if ((letter == DICTIONARY_FIELD) || (letter == '=') || (letter == '\n') || (letter == '\r')) {
+        escaped += DICTIONARY_FIELD;
+        escaped += digits[(unsigned char)letter >> 4];
+        escaped += digits[(unsigned char)letter & 0xF];
+      }
+      else {
+        escaped += letter;
+      }
+    }
+    return escaped;
+  }
+
+  /**
+   * Reverses Escape_Field. Markers not followed by two hex digits are
+   * kept as they are.
+   * @param text The escaped text.
+   * @return The original text.
+   */
+  std::string Unescape_Field(std::string text) {
+    std::string original;
+    int char_count = text.length();
+    for (int char_index = 0; char_index < char_count; char_index++) {
+      if ((text[char_index] == DICTIONARY_FIELD) && (char_index + 2 < char_count) && std::isxdigit((unsigned char)text[char_index + 1]) && std::isxdigit((unsigned char)text[char_index + 2])) {
+        original += (char)std::stoi(text.substr(char_index + 1, 2), NULL, 16);
+        char_index += 2;
+      }
+      else {
+        original += text[char_index];
+      }
+    }
+    return original;
+  }
+
+  /**
+   * Gets the size of a file.
+   * @param name The name of the file.
+   * @return The size in bytes or 0 if the file does not exist.
+   */
+  long long Get_File_Size(std::string name) {
+    std::error_code error;
+    std::uintmax_t size = std::filesystem::file_size(name, error);
+    return error ? 0 : (long long)size;
+  }
+
+  /**
+   * Reads an uncompressed 24 or 32 bit bitmap. Magenta pixels become the
+   * transparent key, and so do pixels with no alpha when the file has an
+   * alpha mask. In plain 32 bit files the fourth byte is padding.
+   * @param name The name of the file.
+   * @param image Receives the image.
+   * @return True if the image was read, false otherwise.
+   */
+  bool Read_Bitmap(std::string name, sSoftware_Image& image) {
+    std::ifstream file(name, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto read = [&](int offset, int size) -> unsigned int {
+      unsigned int value = 0;
+      for (int byte_index = size - 1; byte_index >= 0; byte_index--) {
+        value = (value << 8) | data[offset + byte_index];
+      }
+      return value;
+    };
+    if ((data.size() < 54) || (data[0] != 'B') || (data[1] != 'M')) {
+      return false;
+    }
+    int start = read(10, 4);
+    int header = read(14, 4);
+    int width = (int)read(18, 4);
+    int height = (int)read(22, 4);
+    int depth = read(28, 2);
+    int compression = read(30, 4);
+    bool top_down = (height < 0);
+    height = std::abs(height);
+    long long stride = (((long long)width * (depth / 8)) + 3) & ~3LL;
+    if ((width <= 0) || (height <= 0) || ((depth != 24) && (depth != 32)) ||
+        ((long long)start + (stride * height) > (long long)data.size())) {
+      return false;
+    }
+    // Masks of red, green, blue and alpha. Bit fields follow a plain header
+    // or sit inside a version 4 or 5 header, which also holds alpha.
+    unsigned int masks[4] = { 0xFF0000, 0xFF00, 0xFF, 0 };
+    if (compression == 3) {
+      if ((depth != 32) || (data.size() < 66)) {
+        return false;
+      }
+      masks[0] = read(54, 4);
+      masks[1] = read(58, 4);
+      masks[2] = read(62, 4);
+      if ((header >= 56) && (data.size() >= 70)) {
+        masks[3] = read(66, 4);
+      }
+      if (!masks[0] || !masks[1] || !masks[2]) {
+        return false;
+      }
+    }
+    else if (compression != 0) {
+      return false;
+    }
+    auto channel = [](unsigned int pixel, unsigned int mask) -> unsigned int {
+      unsigned int shift = 0;
+      while (!((mask >> shift) & 1)) {
+        shift++;
+      }
+      unsigned int top = mask >> shift;
+      return (((pixel & mask) >> shift) * 255) / top;
+    };
+    image.width = width;
+    image.height = height;
+    image.opaque = true;
+    image.pixels = std::vector<unsigned int>(width * height);
+    for (int row = 0; row < height; row++) {
+      const unsigned char* source = &data[start + (stride * (top_down ? row : (height - 1 - row)))];
+      for (int column = 0; column < width; column++) {
+        const unsigned char* pixel = source + (column * (depth / 8));
+        unsigned int color = (pixel[2] << 16) | (pixel[1] << 8) | pixel[0];
+        if (compression == 3) {
+          unsigned int bits = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16) | ((unsigned int)pixel[3] << 24);
+          color = (channel(bits, masks[0]) << 16) | (channel(bits, masks[1]) << 8) | channel(bits, masks[2]);
+          if (masks[3] && !(bits & masks[3])) {
+            color = SOFTWARE_KEY;
+          }
+        }
+        if (color == SOFTWARE_KEY) {
+          image.opaque = false;
+        }
+        image.pixels[(row * width) + column] = color;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Writes pixels as a 24 bit bitmap.
+   * @param name The name of the file.
+   * @param pixels The pixels, top row first.
+   * @param width The width.
+   * @param height The height.
+   * @return True if the file was written, false otherwise.
+   */
+  bool Write_Bitmap(std::string name, std::vector<unsigned int>& pixels, int width, int height) {
+    int stride = ((width * 3) + 3) & ~3;
+    std::vector<unsigned char> data(54 + (stride * height), 0);
+    auto write = [&](int offset, int size, unsigned int value) {
+      for (int byte_index = 0; byte_index < size; byte_index++) {
+        data[offset + byte_index] = (value >> (8 * byte_index)) & 0xFF;
+      }
+    };
+    data[0] = 'B';
+    data[1] = 'M';
+    write(2, 4, data.size());
+    write(10, 4, 54);
+    write(14, 4, 40);
+    write(18, 4, width);
+    write(22, 4, height);
+    write(26, 2, 1);
+    write(28, 2, 24);
+    write(34, 4, stride * height);
+    for (int row = 0; row < height; row++) {
+      unsigned char* dest = &data[54 + (stride * (height - 1 - row))];
+      for (int column = 0; column < width; column++) {
+        unsigned int color = pixels[(row * width) + column];
+        dest[(column * 3) + 0] = color & 0xFF;
+        dest[(column * 3) + 1] = (color >> 8) & 0xFF;
+        dest[(column * 3) + 2] = (color >> 16) & 0xFF;
+      }
+    }
+    std::ofstream file(name, std::ios::binary);
+    file.write((const char*)data.data(), data.size());
+    return (bool)file;
+  }
+
+  /**
+   * Writes pixels as a binary portable pixmap.
+   * @param name The name of the file.
+   * @param pixels The pixels, top row first.
+   * @param width The width.
+   * @param height The height.
+   * @return True if the file was written, false otherwise.
+   */
+  bool Write_Pixmap(std::string name, std::vector<unsigned int>& pixels, int width, int height) {
+    std::ofstream file(name, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<unsigned char> row(width * 3);
+    for (int row_index = 0; row_index < height; row_index++) {
+      for (int column = 0; column < width; column++) {
+        unsigned int color = pixels[(row_index * width) + column];
+        row[(column * 3) + 0] = (color >> 16) & 0xFF;
+        row[(column * 3) + 1] = (color >> 8) & 0xFF;
+        row[(column * 3) + 2] = color & 0xFF;
+      }
+      file.write((const char*)row.data(), row.size());
+    }
+    return (bool)file;
+  }
+
+  /**
+   * Makes a token and classifies it as a number or a word.
+   * @param text The text of the token.
+   * @param line_no The line number of the token.
+   * @param source The name of the source code.
+   * @return The token.
+   */
+  sCode_Token Make_Token(std::string text, int line_no, std::string source) {
+    sCode_Token token;
+    token.token = text;
+    token.line_no = line_no;
+    token.source = source;
+    token.number = 0;
+    token.type = Parse_Number(text, token.number) ? eTOKEN_NUMBER : eTOKEN_WORD;
+    return token;
+  }
+
+  /**
+   * Registers the built in native functions.
+   */
+  void Register_Natives() {
+    if (native_registry.functions.size() == 0) {
+      native_registry.Register("min", Native_Min);
+      native_registry.Register("max", Native_Max);
+      native_registry.Register("clamp", Native_Clamp);
+      native_registry.Register("distance", Native_Distance);
+    }
+  }
+
+  /**
+   * Gets the smallest of the arguments.
+   * @param frame The argument frame.
+   */
+  void Native_Min(sNative_Frame& frame) {
+    if (frame.count > 0) {
+      int result = frame.args[0].number;
+      for (int arg_index = 1; arg_index < frame.count; arg_index++) {
+        result = std::min(result, frame.args[arg_index].number);
+      }
+      frame.result.Set_Number(result);
+    }
+  }
+
+  /**
+   * Gets the largest of the arguments.
+   * @param frame The argument frame.
+   */
+  void Native_Max(sNative_Frame& frame) {
+    if (frame.count > 0) {
+      int result = frame.args[0].number;
+      for (int arg_index = 1; arg_index < frame.count; arg_index++) {
+        result = std::max(result, frame.args[arg_index].number);
+      }
+      frame.result.Set_Number(result);
+    }
+  }
+
+  /**
+   * Clamps a value to a range. The arguments are the value, the lower
+   * bound and the upper bound.
+   * @param frame The argument frame.
+   */
+  void Native_Clamp(sNative_Frame& frame) {
+    if (frame.count == 3) {
+      frame.result.Set_Number(std::max(frame.args[1].number, std::min(frame.args[0].number, frame.args[2].number)));
+    }
+  }
+
+  /**
+   * Gets the distance between two points. The arguments are x1, y1, x2
+   * and y2.
+   * @param frame The argument frame.
+   */
+  void Native_Distance(sNative_Frame& frame) {
+    if (frame.count == 4) {
+      double x = (double)frame.args[2].number - frame.args[0].number;
+      double y = (double)frame.args[3].number - frame.args[1].number;
+      frame.result.Set_Number((int)std::sqrt((x * x) + (y * y)));
+    }
+  }
+
+  // **************************************************************************
+  // Hot Loader Implementation
+  // **************************************************************************
+
+  /**
+   * Creates a new hot loader which watches the source modules.
+   * @param compiler The compiler that built the running program.
+   * @param simulator The simulator running the program.
+   * @param interval The number of milliseconds between checks.
+   */
+  cHot_Loader::cHot_Loader(cCompiler* compiler, cSimulator* simulator, int interval) {
+    this->compiler = compiler;
+    this->simulator = simulator;
+    this->interval = interval;
+    this->last_check = std::chrono::system_clock::now();
+    this->old_end = 0;
+    this->new_end = 0;
+  }
+
+  /**
+   * Checks if the source modules changed. Only checks once per interval.
+   * @return True if the program needs to be reloaded, false otherwise.
+   */
+  bool cHot_Loader::Check() {
+    bool changed = false;
+    auto now = std::chrono::system_clock::now();
+    auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - this->last_check);
+    if (diff.count() >= this->interval) {
+      this->last_check = now;
+      changed = this->compiler->Has_Changed();
+    }
+    return changed;
+  }
+
+  /**
+   * Recompiles the changed modules and patches the running program. Code
+   * blocks are replaced, data blocks are carried over by label, and the
+   * program pointer, return addresses and timers are relocated by label.
+   * Anything that could not be migrated is reported.
+   */
+  void cHot_Loader::Reload() {
+    cMemory* live = this->compiler->memory;
+    cSymbol_Table old_symtab = this->compiler->symtab;
+    cArray<std::string> old_label_names = this->compiler->labels;
+    this->old_labels = this->Get_Labels();
+    this->old_end = this->compiler->pointer;
+    cMemory image(live->count, live->heap_size); // Fails the compile if the program grows into a sized heap.
+    this->compiler->memory = &image;
+    try {
+      this->compiler->Compile(this->compiler->source);
+    }
+    catch (cError error) {
+      this->compiler->memory = live;
+      this->compiler->symtab = old_symtab;
+      this->compiler->labels = old_label_names;
+      this->compiler->pointer = this->old_end;
+      error.Print();
+      std::cout << "Reload failed, program was not changed." << std::endl;
+      return;
+    }
+    this->compiler->memory = live;
+    this->new_labels = this->Get_Labels();
+    this->new_end = this->compiler->pointer;
+    if (this->new_end > live->heap_start) {
+      std::cout << "Reload: program grew into the heap." << std::endl;
+    }
+    this->old_label_index.Clear();
+    int label_count = this->old_labels.size();
+    for (int label_index = 0; label_index < label_count; label_index++) {
+      this->old_label_index[this->old_labels[label_index].name] = label_index;
+    }
+    this->new_label_index.Clear();
+    label_count = this->new_labels.size();
+    for (int label_index = 0; label_index < label_count; label_index++) {
+      this->new_label_index[this->new_labels[label_index].name] = label_index;
+    }
+    // Carry over data blocks. Blocks that keep their address are left alone
+    // so saves do not see them as changed.
+    std::vector<bool> kept(live->count, false);
+    std::string reset_label = "";
+    for (int block_index = 0; block_index < live->count; block_index++) {
+      if (block_index < this->new_end) {
+        if (image[block_index].code == eCMD_NONE) {
+          int label_index = this->Find_Label(this->new_labels, block_index);
+          std::string name = (label_index >= 0) ? this->new_labels[label_index].name : "";
+          int address = (label_index >= 0) ? block_index - this->new_labels[label_index].address : block_index;
+          int old_index = this->old_label_index.Does_Key_Exist(name) ? this->old_label_index[name] : -1;
+          int old_address = -1;
+          if ((old_index >= 0) || (name == "")) {
+            int start = (old_index >= 0) ? this->old_labels[old_index].address : 0;
+            int end = (old_index >= 0) ? this->Get_Label_End(this->old_labels, old_index, this->old_end) : this->old_end;
+            if ((start + address < end) && ((*live)[start + address].code == eCMD_NONE)) {
+              old_address = start + address;
+            }
+          }
+          if (old_address == block_index) {
+            kept[block_index] = true;
+          }
+          else if (old_address >= 0) {
+            image[block_index] = (*live)[old_address];
+          }
+          else if (reset_label != name) {
+            std::cout << "Reload: data under " << ((name == "") ? "program start" : name) << " was reset." << std::endl;
+            reset_label = name;
+          }
+        }
+      }
+      else if (block_index >= this->old_end) { // Runtime data outside of the program.
+        kept[block_index] = true;
+      }
+    }
+    // Relocate the program pointer and return addresses.
+    int pointer = this->Relocate(this->simulator->pointer);
+    if (pointer >= 0) {
+      this->simulator->pointer = pointer;
+    }
+    else {
+      std::cout << "Reload: could not relocate program pointer " << this->simulator->pointer << "." << std::endl;
+    }
+    int stack_count = this->simulator->stack.Count();
+    for (int stack_index = 0; stack_index < stack_count; stack_index++) {
+      int address = this->simulator->stack[stack_index];
+      if (this->simulator->return_marks[stack_index]) {
+        int return_address = this->Relocate(address);
+        if (return_address >= 0) {
+          this->simulator->stack[stack_index] = return_address;
+        }
+        else {
+          std::cout << "Reload: could not relocate return address " << address << "." << std::endl;
+        }
+      }
+    }
+    int frame_count = this->simulator->calls.count;
+    for (int frame_index = 1; frame_index < frame_count; frame_index++) { // The root frame does not return.
+      sFrame& frame = this->simulator->calls.frames[frame_index];
+      int return_address = this->Relocate(frame.return_address);
+      if (return_address >= 0) {
+        frame.return_address = return_address;
+      }
+      else {
+        std::cout << "Reload: could not relocate return address " << frame.return_address << "." << std::endl;
+      }
+    }
+    cTimer_Wheel* wheels[] = { &this->simulator->time_wheel, &this->simulator->frame_wheel };
+    for (cTimer_Wheel* wheel : wheels) {
+      int timer_count = wheel->timers.size();
+      for (int timer_index = 0; timer_index < timer_count; timer_index++) {
+        sTimer& timer = wheel->timers[timer_index];
+        if (timer.active) {
+          int address = this->Relocate(timer.address);
+          if (address >= 0) {
+            timer.address = address;
+          }
+          else {
+            std::cout << "Reload: could not relocate timer " << timer.address << "." << std::endl;
+          }
+        }
+      }
+    }
+    for (int block_index = 0; block_index < live->count; block_index++) {
+      if (!kept[block_index]) {
+        live->Write(block_index) = image[block_index];
+      }
+    }
+    std::cout << "Reloaded " << this->compiler->source << "." << std::endl;
+  }
+
+  /**
+   * Gets the labels of the compiled program sorted by address.
+   * @return The list of labels.
+   */
+  std::vector<sLabel> cHot_Loader::Get_Labels() {
+    std::vector<sLabel> labels;
+    int label_count = this->compiler->labels.Count();
+    for (int label_index = 0; label_index < label_count; label_index++) {
+      sLabel label;
+      label.name = this->compiler->labels[label_index];
+      label.address = this->compiler->symtab[label.name];
+      labels.push_back(label);
+    }
+    std::stable_sort(labels.begin(), labels.end(), [](const sLabel& left, const sLabel& right) {
+      return (left.address < right.address);
+    });
+    return labels;
+  }
+
+  /**
+   * Finds the label that an address belongs to.
+   * @param labels The labels sorted by address.
+   * @param address The address to look up.
+   * @return The index of the last label at or before the address, or -1.
+   */
+  int cHot_Loader::Find_Label(std::vector<sLabel>& labels, int address) {
+    int low = 0;
+    int high = labels.size();
+    while (low < high) { // Find first label after the address.
+      int middle = (low + high) / 2;
+      if (labels[middle].address <= address) {
+        low = middle + 1;
+      }
+      else {
+        high = middle;
+      }
+    }
+    return (low - 1);
+  }
+
+  /**
+   * Gets the address where a label's region ends.
+   * @param labels The labels sorted by address.
+   * @param index The index of the label.
+   * @param end The end of the program.
+   * @return The address after the last block of the label.
+   */
+  int cHot_Loader::Get_Label_End(std::vector<sLabel>& labels, int index, int end) {
+    int label_count = labels.size();
+    for (int label_index = index + 1; label_index < label_count; label_index++) {
+      if (labels[label_index].address > labels[index].address) {
+        end = labels[label_index].address;
+        break;
+      }
+    }
+    return end;
+  }
+
+  /**
+   * Relocates an old code address to the new program by its label.
+   * @param address The old address.
+   * @return The new address or -1 if the label no longer resolves.
+   */
+  int cHot_Loader::Relocate(int address) {
+    int result = -1;
+    int old_index = this->Find_Label(this->old_labels, address);
+    if (old_index >= 0) {
+      std::string name = this->old_labels[old_index].name;
+      int offset = address - this->old_labels[old_index].address;
+      if (this->new_label_index.Does_Key_Exist(name)) {
+        int new_index = this->new_label_index[name];
+        int start = this->new_labels[new_index].address;
+        if (start + offset < this->Get_Label_End(this->new_labels, new_index, this->new_end)) {
+          result = start + offset;
+        }
+      }
+    }
+    return result;
+  }
+
+}
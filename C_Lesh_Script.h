@@ -5,6 +5,19 @@
 
 #include "..\Code_Helper\Codeloader.hpp"
 #include "..\Code_Helper\Allegro.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <climits>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <charconv>
+#include <cstring>
 
 namespace Codeloader {
 
@@ -24,7 +37,8 @@ namespace Codeloader {
     eADDR_VAL_NUMBER,
     eADDR_VAL_STRING,
     eADDR_IMMEDIATE,
-    eADDR_POINTER
+    eADDR_POINTER,
+    eADDR_FRAME
   };
 
   enum eCommand {
@@ -50,7 +64,52 @@ namespace Codeloader {
     eCMD_POP,
     eCMD_REPEAT,
     eCMD_GET_OBJECT,
-    eCMD_GET_LIST
+    eCMD_GET_LIST,
+    eCMD_INPUT_EVENTS,
+    eCMD_INPUT_WAIT,
+    eCMD_FRAME_STATS,
+    eCMD_LOAD_ASYNC,
+    eCMD_SAVE_ASYNC,
+    eCMD_IO_WAIT,
+    eCMD_SAVE_CHANGES,
+    eCMD_CALL_NATIVE,
+    eCMD_DRAW_MAP,
+    eCMD_SPATIAL_BUILD,
+    eCMD_SPATIAL_UPDATE,
+    eCMD_SPATIAL_OVERLAPS,
+    eCMD_SPATIAL_POINT,
+    eCMD_SPATIAL_RECT,
+    eCMD_FIND_PATH,
+    eCMD_FLOW_FIELD,
+    eCMD_PARALLEL_EACH,
+    eCMD_CHANNEL,
+    eCMD_SEND,
+    eCMD_TRY_SEND,
+    eCMD_RECEIVE,
+    eCMD_TRY_RECEIVE,
+    eCMD_SPAWN,
+    eCMD_SCHEDULE,
+    eCMD_SCHEDULE_FRAMES,
+    eCMD_CANCEL,
+    eCMD_QUOTA_USAGE,
+    eCMD_INVOKE,
+    eCMD_TAIL_INVOKE,
+    eCMD_ENTER,
+    eCMD_LEAVE,
+    eCMD_STORE_LOCAL,
+    eCMD_ALLOC,
+    eCMD_FREE,
+    eCMD_SCRATCH,
+    eCMD_MARK,
+    eCMD_RELEASE,
+    eCMD_HEAP_STATS,
+    eCMD_DICT_SET,
+    eCMD_DICT_GET,
+    eCMD_DICT_HAS,
+    eCMD_DICT_REMOVE,
+    eCMD_DICT_COUNT,
+    eCMD_DICT_ENTRY,
+    eCMD_DICT_CLEAR
   };
 
   enum eTest {
@@ -67,12 +126,115 @@ namespace Codeloader {
     eLOGIC_OR
   };
 
-  typedef cHash<std::string, cValue> tObject;
+  enum eToken {
+    eTOKEN_WORD,
+    eTOKEN_NUMBER
+  };
+
+  const unsigned long long HASH_SEED = 14695981039346656037ULL;
+  const int CACHE_VERSION = 1; // Bump when tokens or their cache lines change.
+  const int INPUT_NONE = 0; // Signal code when no input is pending.
+  const int INPUT_POLL_LIMIT = 32;
+  const int INPUT_QUEUE_LIMIT = 256;
+  const int PACE_MARGIN = 1000; // Microseconds kept free in each frame.
+  const int JOURNAL_MINIMUM = 64; // Patches kept before a journal may be compacted.
+  const int TEXT_BUFFER_SIZE = 256; // Initial capacity of the cat buffer.
+  const int NATIVE_ARG_LIMIT = 8;
+  const int PARALLEL_STEP_LIMIT = 1000000; // Instructions allowed per element.
+  const int PARALLEL_RETURN = -1; // Return address that ends an element.
+  const int SPATIAL_CELL_LIMIT = 64; // Cells an object covers before it is kept apart.
+  const int PATH_SEARCH_LIMIT = 16; // Path searches kept between calls.
+  const int CHANNEL_LIMIT = 65536; // Largest number of slots in a channel.
+  const int SPAWN_MEMORY_LIMIT = 1 << 20; // Largest memory of a spawned instance.
+  const int SPAWN_INSTANCE_LIMIT = 64; // Instances one simulator may spawn.
+  const int INSTANCE_SLICE = 10; // Milliseconds an instance runs between checks.
+  const int INSTANCE_SPIN_LIMIT = 64; // Blocked slices before an instance sleeps.
+  const int WHEEL_LEVELS = 4;
+  const int WHEEL_BITS = 6;
+  const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+  const int TIMER_LIMIT = 1 << 20; // Timers per wheel, which fit in a handle.
+  const int SYMBOL_TABLE_MINIMUM = 256; // Slots, always a power of two.
+  const int CALL_STACK_SLOTS = 16384; // Argument and local slots of all frames.
+  const int CALL_STACK_FRAMES = 1024; // Deepest nesting of invoke.
+  const int HEAP_CLASSES = 10; // Pool size classes from 1 to 512 blocks.
+  const int HEAP_POISON = (int)0xDEADBEEF; // Value of freed blocks in debug builds.
+  const int DICTIONARY_MINIMUM = 8; // Slots, always a power of two.
+  const char DICTIONARY_FIELD = '%'; // Marks dictionary entries in saved objects.
+  const int SOFTWARE_TILE = 16; // Pixels per side of a dirty tile.
+  const unsigned int SOFTWARE_KEY = 0xFF00FF; // Transparent color of images.
+  const unsigned int SOFTWARE_MISSING = 0x7F007F; // Fills images that could not be loaded.
+  const int FONT_SCALE = 2; // Pixels per font dot.
+  const int RENDER_FRAME_LIMIT = 3600; // Frames rendered before stopping.
+  const int RENDER_IDLE_LIMIT = 1000; // Slices without a frame before stopping.
+
+  typedef std::shared_ptr<const std::string> tString;
+
+  class cString_Pool {
+
+    public:
+      std::mutex lock;
+      std::unordered_map<std::string, tString> strings;
+
+      tString Intern(std::string text);
+
+  };
+
+  class cScript_Value {
+
+    public:
+      int type;
+      int number;
+      bool interned;
+      tString text;
+
+      cScript_Value();
+      void Set_Number(int number);
+      void Set_String(std::string text);
+      void Set_Interned(std::string text);
+      void Convert_To_String();
+      const std::string& Get_String() const;
+      bool Equals(const cScript_Value& other) const;
+
+  };
+
+  extern cString_Pool string_pool;
+
+  typedef cHash<std::string, cScript_Value> tObject;
+
+  class cSimulator;
+
+  struct sNative_Frame {
+    cScript_Value args[NATIVE_ARG_LIMIT];
+    int count;
+    cScript_Value result;
+    cSimulator* simulator;
+  };
+
+  typedef void (*tNative_Function)(sNative_Frame& frame);
+
+  class cNative_Registry {
+
+    public:
+      std::vector<tNative_Function> functions;
+      std::vector<std::string> names;
+      std::unordered_map<std::string, int> index;
+
+      int Register(std::string name, tNative_Function function);
+      int Find(std::string name);
+
+  };
+
+  extern cNative_Registry native_registry;
+
+  struct sCode_Token : public sToken {
+    int type;
+    int number;
+  };
 
   struct sOperand_Operator {
     int oper_code;
     int addr_mode;
-    cValue value;
+    cScript_Value value;
     std::string field;
     std::string placeholder;
   };
@@ -86,6 +248,30 @@ namespace Codeloader {
     int right_exp;
   };
 
+  struct sDictionary_Entry {
+    cScript_Value key;
+    cScript_Value value;
+    unsigned int hash;
+  };
+
+  class cDictionary {
+
+    public:
+      std::vector<sDictionary_Entry> entries;
+      std::vector<int> slots;
+
+      cDictionary();
+      cScript_Value* Find(cScript_Value key);
+      void Set(cScript_Value key, cScript_Value value);
+      bool Remove(cScript_Value key);
+      int Count();
+      unsigned int Hash(const cScript_Value& key);
+      bool Same_Key(const cScript_Value& left, const cScript_Value& right);
+      int Probe(const cScript_Value& key, unsigned int hash);
+      void Grow();
+
+  };
+
   class cBlock {
 
     public:
@@ -93,11 +279,23 @@ namespace Codeloader {
       cArray<tExpression> expressions;
       cArray<sCondition_Logic> conditional;
       tObject fields;
-      cValue value;
+      cScript_Value value;
+      std::shared_ptr<cDictionary> dict;
 
       cBlock();
       void Clear();
+      tObject Pack_Fields();
+      void Unpack_Fields(tObject& object);
+
+  };
 
+  struct sHeap_Stats {
+    int used;
+    int requested;
+    int pooled;
+    int allocs;
+    int frees;
+    int failures;
   };
 
   class cMemory {
@@ -105,28 +303,130 @@ namespace Codeloader {
     public:
       int count;
       cBlock* memory;
+      unsigned long long* stamps;
+      unsigned long long clock;
+      int* links;
+      int* classes;
+      int free_lists[HEAP_CLASSES];
+      int heap_size;
+      int heap_start;
+      int heap_top;
+      int arena_top;
+      sHeap_Stats heap;
 
-      cMemory(int size);
+      cMemory(int size, int heap_size);
       ~cMemory();
       cBlock& operator[] (int address);
+      cBlock& Write(int address);
       void Clear();
+      void Init_Heap(int program_end);
+      int Allocate(int size);
+      bool Free(int address);
+      int Allocate_Scratch(int size);
+      bool Release(int mark);
+      void Poison(int address, int size);
+      bool Is_Poisoned(int address, int size);
+
+  };
+
+  struct sModule {
+    std::string name;
+    std::filesystem::file_time_type time;
+    cArray<sCode_Token> tokens;
+  };
+
+  struct sSymbol {
+    std::string name;
+    int value;
+    bool relative;
+  };
 
+  struct sSymbol_Slot {
+    tString name;
+    int value;
+  };
+
+  class cSymbol_Table {
+
+    public:
+      std::vector<sSymbol_Slot> slots;
+      int count;
+
+      cSymbol_Table();
+      int& operator[] (std::string name);
+      int* Find(tString name);
+      bool Does_Key_Exist(std::string name);
+      int Count();
+      void Clear();
+      int Probe(const std::string* name);
+      void Grow();
+
+  };
+
+  struct sFixup {
+    int address;
+    int expression;
+    int operand;
+    tString name;
+  };
+
+  class cThread_Pool {
+
+    public:
+      std::vector<std::thread> workers;
+      std::deque<std::function<void()>> jobs;
+      std::mutex lock;
+      std::condition_variable signal;
+      bool running;
+
+      cThread_Pool(int count);
+      ~cThread_Pool();
+      void For_Each(int count, std::function<void(int)> job);
+      void Work();
+
+  };
+
+  struct sLabel {
+    std::string name;
+    int address;
   };
 
   class cCompiler {
 
     public:
-      cHash<std::string, int> symtab;
+      cSymbol_Table symtab;
+      cArray<sFixup> fixups;
+      cHash<std::string, sModule> modules;
+      cHash<std::string, int> imported;
+      cArray<sSymbol> symbols;
+      cArray<std::string> labels;
       cMemory* memory;
+      std::vector<cBlock> blocks;
       int pointer;
-      cArray<sToken> tokens;
+      cArray<sCode_Token> tokens;
+      int token_index;
+      std::string source;
 
       cCompiler(std::string source, cMemory* memory);
+      cCompiler(cArray<sCode_Token> tokens);
+      void Compile(std::string source);
+      static cThread_Pool& Get_Pool();
+      void Load_Modules(std::string source, cThread_Pool& pool);
+      void Collect_Segments(std::string source, std::vector<cArray<sCode_Token>>& segments);
+      void Link_Unit(cCompiler& unit);
+      cBlock& Allocate_Block();
+      void Define_Symbol(std::string name, int value, bool relative);
       void Parse_Tokens(std::string source);
-      sToken Parse_Token();
-      sToken Peek_Token();
+      cArray<sCode_Token> Load_Module(std::string source);
+      sModule Read_Module(std::string source);
+      bool Is_Module_Current(std::string source);
+      bool Read_Module_Cache(std::string source, unsigned long long hash, sModule& module);
+      void Write_Module_Cache(std::string source, unsigned long long hash, sModule& module);
+      bool Has_Changed();
+      sCode_Token Parse_Token();
+      sCode_Token Peek_Token();
       void Parse_Keyword(std::string keyword);
-      void Generate_Parse_Error(std::string message, sToken token);
+      void Generate_Parse_Error(std::string message, sCode_Token token);
       int Parse_Expression(cBlock& command);
       sOperand_Operator Parse_Operand();
       sOperand_Operator Parse_Operator();
@@ -142,25 +442,601 @@ namespace Codeloader {
 
   };
 
+  struct sInput_Event {
+    int code;
+    long long time;
+  };
+
+  enum eRecord {
+    eRECORD_WRITE,
+    eRECORD_REPLAY
+  };
+
+  struct sFrame_Stats {
+    int frames;
+    int fps;
+    int frame_time;
+    int script_time;
+    int render_time;
+    int budget;
+  };
+
+  struct sReplay_Slice {
+    int count;
+    long long time;
+    sFrame_Stats stats;
+    std::vector<int> events;
+    std::vector<int> randoms;
+    std::vector<std::string> messages;
+  };
+
+  class cRecorder {
+
+    public:
+      int mode;
+      std::ofstream file;
+      std::vector<sReplay_Slice> slices;
+      int slice_index;
+      int random_index;
+      int message_index;
+
+      cRecorder(std::string name, int mode);
+      bool Has_Slice();
+      void Begin_Slice(long long& clock, std::deque<sInput_Event>& events, sFrame_Stats& stats);
+      void Record_Event(int code);
+      int Random(int lower, int upper, cIO_Control* io);
+      void Record_Message(bool done, const cScript_Value& value);
+      bool Replay_Message(cScript_Value& value);
+      void End_Slice(int count, long long clock);
+      int Get_Count();
+
+  };
+
+  class cHeadless_IO : public cIO_Control {
+
+    public:
+      int draws;
+      int refreshes;
+
+      cHeadless_IO();
+      void Output_Text(std::string text, int x, int y, int red, int green, int blue);
+      void Draw_Image(std::string name, int x, int y, int width, int height, int angle, bool flip_x, bool flip_y);
+      void Refresh();
+      void Play_Sound(std::string name);
+      void Play_Music(std::string name);
+      void Silence();
+      sSignal Read_Signal();
+      void Timeout(int timeout);
+      void Color(int red, int green, int blue);
+
+  };
+
+  struct sSoftware_Image {
+    int width;
+    int height;
+    bool opaque;
+    std::vector<unsigned int> pixels;
+  };
+
+  struct sDirty_Rect {
+    int x;
+    int y;
+    int width;
+    int height;
+  };
+
+  class cSoftware_IO : public cHeadless_IO {
+
+    public:
+      int width;
+      int height;
+      std::vector<unsigned int> pixels;
+      std::vector<unsigned int> shown;
+      std::unordered_map<std::string, sSoftware_Image> images;
+      std::vector<sDirty_Rect> dirty;
+      long long repainted;
+
+      cSoftware_IO(int width, int height);
+      void Output_Text(std::string text, int x, int y, int red, int green, int blue);
+      void Draw_Image(std::string name, int x, int y, int width, int height, int angle, bool flip_x, bool flip_y);
+      void Refresh();
+      void Color(int red, int green, int blue);
+      sSoftware_Image& Get_Image(std::string name);
+      void Fill_Rect(int x, int y, int width, int height, unsigned int color);
+      void Blit(sSoftware_Image& image, int x, int y, bool flip_x, bool flip_y);
+      void Blit_Transformed(sSoftware_Image& image, int x, int y, int width, int height, int angle, bool flip_x, bool flip_y);
+      bool Dump_Frame(std::string name);
+
+  };
+
+  enum eIO_Job {
+    eIO_LOAD,
+    eIO_SAVE
+  };
+
+  enum eIO_Status {
+    eIO_FAILED = -1,
+    eIO_IDLE = 0, // Never started, so waits return at once.
+    eIO_DONE = 1,
+    eIO_PENDING = 2
+  };
+
+  struct sIO_Job {
+    int type;
+    std::string name;
+    int address;
+    int status;
+    bool success;
+    long long elapsed;
+    std::vector<tObject> objects;
+  };
+
+  class cIO_Worker {
+
+    public:
+      std::thread thread;
+      std::mutex lock;
+      std::condition_variable signal;
+      std::deque<sIO_Job> jobs;
+      std::deque<sIO_Job> done;
+      std::atomic<int> completed;
+      bool running;
+
+      cIO_Worker();
+      ~cIO_Worker();
+      void Add(sIO_Job& job);
+      bool Take(sIO_Job& job);
+      void Work();
+      static void Run_Job(sIO_Job& job);
+
+  };
+
+  struct sSave_State {
+    int address;
+    int count;
+    unsigned long long stamp;
+    int entries;
+  };
+
+  struct sSpatial_Entry {
+    int x;
+    int y;
+    int width;
+    int height;
+    int left;
+    int top;
+    int right;
+    int bottom;
+    bool oversized;
+    unsigned long long stamp;
+  };
+
+  class cSpatial_Hash {
+
+    public:
+      int address;
+      int count;
+      int cell_size;
+      std::vector<sSpatial_Entry> entries;
+      std::unordered_map<unsigned long long, std::vector<int>> cells;
+      std::vector<int> oversized;
+      std::vector<unsigned int> marks;
+      unsigned int query;
+
+      cSpatial_Hash();
+      void Build(cMemory* memory, int address, int count, int cell_size);
+      void Update(cMemory* memory);
+      int Query(int x, int y, int width, int height, int exclude, std::vector<int>& results);
+      void Read_Entry(cMemory* memory, int index, sSpatial_Entry& entry);
+      void Insert(int index);
+      void Remove(int index);
+      void Check_Entry(int index, int x, int y, int width, int height, int exclude, std::vector<int>& results);
+      unsigned long long Get_Key(int column, int row);
+
+  };
+
+  enum ePath_Status {
+    ePATH_NONE = -1,
+    ePATH_SEARCHING = -2,
+    ePATH_RESTARTED = -3
+  };
+
+  enum eDirection {
+    eDIR_NONE,
+    eDIR_UP,
+    eDIR_RIGHT,
+    eDIR_DOWN,
+    eDIR_LEFT
+  };
+
+  struct sPath_Search {
+    int list;
+    int grid;
+    int columns;
+    int rows;
+    int start;
+    int goal;
+    bool searching;
+    unsigned int search;
+    long long used;
+    std::vector<unsigned int> visits;
+    std::vector<unsigned int> closed;
+    std::vector<int> costs;
+    std::vector<int> parents;
+    std::vector<std::pair<int, int>> open;
+  };
+
+  class cPathfinder {
+
+    public:
+      std::vector<sPath_Search> searches;
+      sPath_Search flow;
+      long long uses;
+      std::vector<int> path;
+      std::vector<int> directions;
+
+      cPathfinder();
+      int Find_Path(cMemory* memory, int list, int grid, int columns, int rows, int start, int goal, int budget);
+      void Flow_Field(cMemory* memory, int grid, int columns, int rows, int goal);
+      sPath_Search& Get_Search(int list);
+      void Begin(sPath_Search& search, int grid, int columns, int rows);
+      int Get_Distance(sPath_Search& search, int cell);
+
+  };
+
+  enum eChannel {
+    eCHANNEL_SINGLE, // One producer and one consumer.
+    eCHANNEL_MULTI // Many producers and one consumer.
+  };
+
+  enum eElement {
+    eELEMENT_ANY,
+    eELEMENT_NUMBER,
+    eELEMENT_STRING
+  };
+
+  struct sChannel_Slot {
+    std::atomic<std::size_t> sequence;
+    cScript_Value value;
+  };
+
+  class cChannel {
+
+    public:
+      std::string name;
+      int type;
+      int element;
+      std::size_t capacity;
+      std::size_t mask;
+      sChannel_Slot* slots;
+      std::atomic<cSimulator*> producer;
+      alignas(64) std::atomic<std::size_t> head;
+      alignas(64) std::atomic<std::size_t> tail;
+
+      cChannel(std::string name, int type, int element, int capacity);
+      ~cChannel();
+      bool Send(const cScript_Value& value, cSimulator* sender);
+      bool Receive(cScript_Value& value);
+
+  };
+
+  class cChannel_Hub {
+
+    public:
+      std::mutex lock;
+      std::unordered_map<std::string, cChannel*> channels;
+
+      ~cChannel_Hub();
+      cChannel* Open(std::string name, int type, int element, int capacity);
+      cChannel* Find(std::string name);
+
+  };
+
+  extern cChannel_Hub channel_hub;
+
+  enum eWheel {
+    eWHEEL_TIME,
+    eWHEEL_FRAMES
+  };
+
+  struct sTimer {
+    int address;
+    long long due;
+    int next;
+    int prev;
+    int level;
+    int slot;
+    int generation;
+    bool active;
+  };
+
+  class cTimer_Wheel {
+
+    public:
+      int wheel;
+      long long current;
+      int active;
+      int free;
+      std::vector<sTimer> timers;
+      int slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+      cTimer_Wheel(int wheel);
+      int Schedule(int address, long long due);
+      bool Cancel(int handle);
+      void Advance(long long now, std::vector<int>& due);
+      void Insert(int index);
+      void Unlink(int index);
+      void Release(int index);
+
+  };
+
+  struct sFrame {
+    int base;
+    int size;
+    int return_address;
+    int result;
+  };
+
+  class cCall_Stack {
+
+    public:
+      std::vector<cScript_Value> slots;
+      std::vector<sFrame> frames;
+      int count;
+
+      cCall_Stack(int slot_count, int frame_count);
+      void Reset();
+      sFrame& Top();
+      int Get_Top();
+      int Get_Slot(int slot);
+      bool Push(int size, int return_address, int result);
+      bool Resize(int size);
+      void Tail(int size);
+      sFrame Pop();
+
+  };
+
+  enum eFault {
+    eFAULT_NONE,
+    eFAULT_STACK,
+    eFAULT_STRING,
+    eFAULT_FIELDS,
+    eFAULT_READ,
+    eFAULT_WRITE,
+    eFAULT_MEMORY,
+    eFAULT_INSTANCES
+  };
+
+  struct sQuota {
+    int instructions;
+    int stack;
+    int string;
+    int fields;
+    long long read;
+    long long written;
+    long long memory;
+    int instances;
+  };
+
+  struct sQuota_Usage {
+    long long instructions;
+    int stack;
+    long long read;
+    long long written;
+    int throttled;
+    int fault;
+    long long memory;
+    int instances;
+  };
+
+  class cHistogram {
+
+    public:
+      std::vector<long long> bounds;
+      std::vector<long long> counts;
+      long long sum;
+      long long count;
+
+      cHistogram(std::vector<long long> bounds);
+      void Observe(long long value);
+      void Write(std::ostream& file, std::string name, std::string help);
+
+  };
+
+  class cMetrics {
+
+    public:
+      std::string file;
+      int period;
+      long long last_export;
+      long long instructions;
+      long long slices;
+      long long overruns;
+      long long refreshes;
+      long long draws;
+      long long frame_draws;
+      long long loads;
+      long long saves;
+      std::chrono::steady_clock::time_point last_refresh;
+      cHistogram slice_instructions;
+      cHistogram frame_time;
+      cHistogram load_time;
+      cHistogram save_time;
+      cHistogram refresh_draws;
+
+      cMetrics();
+      void Refresh();
+      void Write(std::ostream& file);
+
+  };
+
+  void Write_Metric(std::ostream& file, std::string name, std::string type, std::string help, long long value);
+
+  class cInstance;
+
   class cSimulator {
 
     public:
       cMemory* memory;
       int pointer;
       cArray<int> stack;
+      std::vector<bool> return_marks; // Which stack items are return addresses.
       cIO_Control* io;
       int status;
+      std::deque<sInput_Event> events;
+      std::chrono::system_clock::time_point start_time;
+      bool blocked;
+      long long wait_deadline;
+      bool frame_done;
+      long long render_time;
+      sFrame_Stats frame_stats;
+      long long clock;
+      cRecorder* recorder;
+      cIO_Worker* io_worker;
+      cHash<std::string, sSave_State> saves;
+      std::unordered_map<std::string, int> pending_saves;
+      std::string text_buffer;
+      sNative_Frame native_frame;
+      int view_width;
+      int view_height;
+      std::string tileset;
+      std::unordered_map<int, std::string> tile_names;
+      cSpatial_Hash spatial;
+      std::vector<int> spatial_results;
+      cPathfinder pathfinder;
+      bool worker;
+      int element;
+      int list_address;
+      int list_count;
+      int scratch_address;
+      std::vector<cBlock> scratch;
+      cThread_Pool* pool;
+      std::vector<cSimulator*> workers;
+      std::unordered_map<std::string, cChannel*> channels;
+      std::vector<cInstance*> instances;
+      cTimer_Wheel time_wheel;
+      cTimer_Wheel frame_wheel;
+      long long frame_count;
+      std::vector<int> due_timers;
+      cMetrics metrics;
+      sQuota quota;
+      sQuota_Usage usage;
+      cCall_Stack calls;
 
       cSimulator(cMemory* memory, cIO_Control* io, int program);
+      ~cSimulator();
       void Run(int timeout);
+      void Poll_Input();
+      long long Get_Time();
+      int Get_Random(int lower, int upper);
       void Command_Processor(cBlock& command);
-      cValue Eval_Operand(sOperand_Operator& operand);
-      cValue Eval_Expression(cBlock& command, int index);
+      cScript_Value Eval_Operand(sOperand_Operator& operand);
+      cScript_Value Eval_Expression(cBlock& command, int index);
       bool Eval_Condition(cBlock& command, sCondition_Logic& condition);
       int Eval_Conditional(cBlock& command);
       void Generate_Execution_Error(std::string message, cBlock& command);
       int Load(std::string name, cMemory* memory, int address);
       void Save(std::string name, cMemory* memory, int address, int count);
+      void Save_Changes(std::string name, int address, int count);
+      void Append_Text(std::string& buffer, cScript_Value& value);
+      void Write_Results(int address, int limit);
+      cBlock& Read_Block(int address);
+      cBlock& Write_Block(int address);
+      void Parallel_Each(int address, int count, int routine, int scratch_address, int scratch_size);
+      void Run_Element(int routine);
+      cChannel* Get_Channel(std::string name);
+      bool Send_Message(std::string name, const cScript_Value& value);
+      bool Receive_Message(std::string name, cScript_Value& value);
+      void Dispatch_Timers();
+      void Export_Metrics();
+      void Fault(int fault);
+      bool Check_Stack();
+      bool Check_Fields(tObject& object);
+      bool Charge_Spawn(int size);
+      bool Charge_Read(std::string name);
+      bool Check_Write();
+      void Draw_Map(int address, int columns, int rows, int tile_size, std::string tileset, int camera_x, int camera_y);
+      void Start_IO(sIO_Job& job);
+      void Commit_IO();
+      void Wait_For_Saves(std::string name);
+      void Finish_IO(sIO_Job& job);
+
+  };
+
+  class cInstance {
+
+    public:
+      cMemory memory;
+      cHeadless_IO io;
+      cSimulator simulator;
+      std::string program;
+      std::thread thread;
+      std::atomic<bool> running;
+
+      cInstance(std::string program, int size, int start, int heap_size, sQuota quota);
+      ~cInstance();
+      void Work();
+
+  };
+
+  class cFrame_Pacer {
+
+    public:
+      int target;
+      int budget;
+      double frame_time;
+      double script_time;
+      double render_time;
+      long long frame_script;
+      long long frame_render;
+      int frames;
+      std::chrono::steady_clock::time_point frame_start;
+
+      cFrame_Pacer(int fps);
+      void Process(cSimulator* simulator);
+
+  };
+
+  unsigned long long Hash_Text(std::string text, unsigned long long hash);
+  bool Parse_Number(std::string text, int& number);
+  void Parse_Value(std::string text, cScript_Value& value, bool interned);
+  bool Read_Objects(std::string name, std::vector<tObject>& objects);
+  bool Write_Objects(std::string name, std::vector<tObject>& objects);
+  void Write_Object(std::ostream& file, tObject& object);
+  sCode_Token Make_Token(std::string text, int line_no, std::string source);
+  long long Get_File_Size(std::string name);
+  std::string Escape_Field(std::string text);
+  std::string Unescape_Field(std::string text);
+  bool Read_Bitmap(std::string name, sSoftware_Image& image);
+  bool Write_Bitmap(std::string name, std::vector<unsigned int>& pixels, int width, int height);
+  bool Write_Pixmap(std::string name, std::vector<unsigned int>& pixels, int width, int height);
+  void Register_Natives();
+  void Native_Min(sNative_Frame& frame);
+  void Native_Max(sNative_Frame& frame);
+  void Native_Clamp(sNative_Frame& frame);
+  void Native_Distance(sNative_Frame& frame);
+
+  class cHot_Loader {
+
+    public:
+      cCompiler* compiler;
+      cSimulator* simulator;
+      int interval;
+      std::chrono::system_clock::time_point last_check;
+      std::vector<sLabel> old_labels;
+      std::vector<sLabel> new_labels;
+      cHash<std::string, int> old_label_index;
+      cHash<std::string, int> new_label_index;
+      int old_end;
+      int new_end;
+
+      cHot_Loader(cCompiler* compiler, cSimulator* simulator, int interval);
+      bool Check();
+      void Reload();
+      std::vector<sLabel> Get_Labels();
+      int Find_Label(std::vector<sLabel>& labels, int address);
+      int Get_Label_End(std::vector<sLabel>& labels, int index, int end);
+      int Relocate(int address);
 
   };
 